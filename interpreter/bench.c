@@ -0,0 +1,166 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "vm.h"
+
+#define BENCH_MAX_ITERATIONS 1000
+
+static double monotonicSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static char* readSource(const char* path) {
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) return NULL;
+
+  fseek(file, 0L, SEEK_END);
+  size_t fileSize = ftell(file);
+  rewind(file);
+
+  char* buffer = (char*)malloc(fileSize + 1);
+  if (buffer == NULL) {
+    fclose(file);
+    return NULL;
+  }
+
+  size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
+  fclose(file);
+  if (bytesRead < fileSize) {
+    free(buffer);
+    return NULL;
+  }
+
+  buffer[bytesRead] = '\0';
+  return buffer;
+}
+
+static int compareNames(const void* a, const void* b) {
+  return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+static int compareDoubles(const void* a, const void* b) {
+  double diff = *(const double*)a - *(const double*)b;
+  return (diff > 0) - (diff < 0);
+}
+
+// one iteration on a throwaway VM; script output goes to nullFd so timing
+// isn't dominated by whatever the benchmark prints
+static InterpretResult timedRun(const char* source, int nullFd,
+                                double* seconds) {
+  initVM();
+  vm.outFd = nullFd;
+  double start = monotonicSeconds();
+  InterpretResult result = interpret(source);
+  *seconds = monotonicSeconds() - start;
+  freeVM();
+  return result;
+}
+
+int runBenchmarks(const char* dir, int warmup, int iterations) {
+  if (iterations < 1) iterations = 1;
+  if (iterations > BENCH_MAX_ITERATIONS) iterations = BENCH_MAX_ITERATIONS;
+  if (warmup < 0) warmup = 0;
+
+  DIR* entries = opendir(dir);
+  if (entries == NULL) {
+    fprintf(stderr, "Could not open benchmark directory \"%s\".\n", dir);
+    return 74;
+  }
+
+  char** names = NULL;
+  int nameCount = 0;
+  int nameCapacity = 0;
+  struct dirent* entry;
+  while ((entry = readdir(entries)) != NULL) {
+    const char* extension = strrchr(entry->d_name, '.');
+    if (extension == NULL || strcmp(extension, ".mbr") != 0) continue;
+    if (nameCount == nameCapacity) {
+      nameCapacity = nameCapacity < 8 ? 8 : nameCapacity * 2;
+      names = (char**)realloc(names, sizeof(char*) * nameCapacity);
+      if (names == NULL) exit(1);
+    }
+    names[nameCount++] = strdup(entry->d_name);
+  }
+  closedir(entries);
+  qsort(names, nameCount, sizeof(char*), compareNames);
+
+  int nullFd = open("/dev/null", O_WRONLY);
+  if (nullFd < 0) nullFd = STDOUT_FILENO;
+
+  double* times = (double*)malloc(sizeof(double) * iterations);
+  if (times == NULL) exit(1);
+
+  printf("{\"warmup\": %d, \"iterations\": %d, \"benchmarks\": [", warmup,
+        iterations);
+
+  int status = 0;
+  for (int i = 0; i < nameCount; i++) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+    char* source = readSource(path);
+    if (source == NULL) {
+      fprintf(stderr, "Could not read benchmark \"%s\".\n", path);
+      status = 74;
+      continue;
+    }
+
+    bool failed = false;
+    for (int w = 0; w < warmup && !failed; w++) {
+      double ignored;
+      failed = timedRun(source, nullFd, &ignored) != INTERPRET_OK;
+    }
+    int completed = 0;
+    for (int iter = 0; iter < iterations && !failed; iter++) {
+      failed = timedRun(source, nullFd, &times[iter]) != INTERPRET_OK;
+      if (!failed) completed++;
+    }
+    free(source);
+
+    printf("%s\n  {\"name\": \"%s\"", i == 0 ? "" : ",", names[i]);
+    if (failed) {
+      printf(", \"error\": true}");
+      continue;
+    }
+
+    qsort(times, completed, sizeof(double), compareDoubles);
+    double min = times[0];
+    double median = completed % 2 == 1
+        ? times[completed / 2]
+        : (times[completed / 2 - 1] + times[completed / 2]) / 2;
+    double mean = 0;
+    for (int iter = 0; iter < completed; iter++) mean += times[iter];
+    mean /= completed;
+    double variance = 0;
+    for (int iter = 0; iter < completed; iter++) {
+      variance += (times[iter] - mean) * (times[iter] - mean);
+    }
+    variance /= completed;
+
+    // ru_maxrss is the process-wide high-water mark, so it can only grow
+    // from one benchmark to the next
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    printf(", \"min_s\": %.6f, \"median_s\": %.6f, \"stddev_s\": %.6f"
+          ", \"peak_rss_kb\": %ld}",
+          min, median, sqrt(variance), usage.ru_maxrss);
+  }
+
+  printf("\n]}\n");
+
+  if (nullFd != STDOUT_FILENO) close(nullFd);
+  for (int i = 0; i < nameCount; i++) free(names[i]);
+  free(names);
+  free(times);
+  return status;
+}
@@ -0,0 +1,10 @@
+#ifndef embr_bench_h
+#define embr_bench_h
+
+// Runs every .mbr file under 'dir' with the given warmup and timed iteration
+// counts, a fresh VM per iteration, and prints machine-readable JSON results
+// (min/median/stddev wall time and peak RSS) to stdout. Returns the exit code
+// for main: 0 on success, 74 if the directory or a script can't be read.
+int runBenchmarks(const char* dir, int warmup, int iterations);
+
+#endif
@@ -9,13 +9,21 @@ void initChunk(Chunk* chunk) {
   chunk->capacity = 0;
   chunk->code = NULL;
   chunk->lines = NULL;
+  chunk->lineRunCount = 0;
   initValueArray(&chunk->constants);
+  chunk->caches = NULL;
+  chunk->cacheCount = 0;
+  chunk->cacheCapacity = 0;
+  chunk->mapped = false;
 }
 
 void freeChunk(Chunk* chunk) {
-  FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-  FREE_ARRAY(LineRun, chunk->lines, chunk->capacity);
+  if (!chunk->mapped) {
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(LineRun, chunk->lines, chunk->capacity);
+  }
   freeValueArray(&chunk->constants);
+  FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCapacity);
   initChunk(chunk);
 }
 
@@ -30,20 +38,37 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line) {
   chunk->code[chunk->count] = byte;
   chunk->count++;
 
-  if (chunk->count == 1 || chunk->lines[chunk->count - 2].line != line) {
-    if (chunk->count > 1 && chunk->lines[chunk->count - 2].line == line) {
-      chunk->lines[chunk->count - 2].count++;
-    } else {
-      LineRun run;
-      run.line = line;
-      run.count = 1;
-      chunk->lines[chunk->count - 1] = run;
-    }
+  // run-length encoded: extend the current run while the line holds. There
+  // are never more runs than bytes, so the lines array shares the code
+  // array's capacity.
+  if (chunk->lineRunCount > 0 &&
+      chunk->lines[chunk->lineRunCount - 1].line == line) {
+    chunk->lines[chunk->lineRunCount - 1].count++;
   } else {
-    chunk->lines[chunk->count - 2].count++;
+    LineRun run;
+    run.line = line;
+    run.count = 1;
+    chunk->lines[chunk->lineRunCount++] = run;
   }
 }
 
+// drops bytes off the tail of the chunk, keeping the line-run table in step;
+// peephole rewrites rewind through here so getLine stays accurate for
+// everything emitted afterwards
+void rewindChunk(Chunk* chunk, int count) {
+  int excess = chunk->count - count;
+  while (excess > 0) {
+    LineRun* run = &chunk->lines[chunk->lineRunCount - 1];
+    if (run->count > excess) {
+      run->count -= excess;
+      break;
+    }
+    excess -= run->count;
+    chunk->lineRunCount--;
+  }
+  chunk->count = count;
+}
+
 int addConstant(Chunk* chunk, Value value) {
   push(value);
   writeValueArray(&chunk->constants, value);
@@ -51,8 +76,38 @@ int addConstant(Chunk* chunk, Value value) {
   return chunk->constants.count - 1;
 }
 
+// the compiler reuses pool entries instead of appending duplicates; strings
+// are interned so this is pointer equality for them. The bytecode loader
+// must NOT dedup -- serialized code indexes the pool positionally.
+int findConstant(Chunk* chunk, Value value) {
+  for (int i = 0; i < chunk->constants.count; i++) {
+    if (valuesEqual(chunk->constants.values[i], value)) return i;
+  }
+  return -1;
+}
+
+int addInlineCache(Chunk* chunk) {
+  if (chunk->cacheCapacity < chunk->cacheCount + 1) {
+    int oldCapacity = chunk->cacheCapacity;
+    chunk->cacheCapacity = GROW_CAPACITY(oldCapacity);
+    chunk->caches = GROW_ARRAY(InlineCache, chunk->caches, oldCapacity, chunk->cacheCapacity);
+  }
+
+  InlineCache* cache = &chunk->caches[chunk->cacheCount];
+  cache->kind = CACHE_EMPTY;
+  cache->index = 0;
+  cache->id = NULL;
+  cache->payload = NULL;
+  cache->id2 = NULL;
+  cache->payload2 = NULL;
+  cache->shape = NULL;
+  cache->shape2 = NULL;
+  return chunk->cacheCount++;
+}
+
 void writeConstant(Chunk* chunk, Value value, int line) {
-  int index = addConstant(chunk, value);
+  int index = findConstant(chunk, value);
+  if (index < 0) index = addConstant(chunk, value);
   if (index < 256) {
     writeChunk(chunk, OP_CONSTANT, line);
     writeChunk(chunk, (uint8_t)index, line);
@@ -66,7 +121,7 @@ void writeConstant(Chunk* chunk, Value value, int line) {
 
 int getLine(Chunk* chunk, int instruction) {
   int offset = 0;
-  for (int i = 0; i < chunk->count; i++) {
+  for (int i = 0; i < chunk->lineRunCount; i++) {
     if (instruction < offset + chunk->lines[i].count) {
       return chunk->lines[i].line;
     }
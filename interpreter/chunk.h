@@ -13,9 +13,15 @@ typedef enum {
   OP_POP,
   OP_GET_LOCAL,
   OP_SET_LOCAL,
+  // 'x = x + 1' / 'x = x - 1' collapsed into one instruction; pushes the
+  // new value like the assignment it replaces
+  OP_INC_LOCAL,
+  OP_DEC_LOCAL,
   OP_GET_GLOBAL,
   OP_DEFINE_GLOBAL,
   OP_SET_GLOBAL,
+  OP_INC_GLOBAL,
+  OP_DEC_GLOBAL,
   OP_GET_UPVALUE,
   OP_SET_UPVALUE,
   OP_GET_PROPERTY,
@@ -34,8 +40,19 @@ typedef enum {
   OP_OUT,
   OP_JUMP,
   OP_JUMP_IF_FALSE,
+  OP_JUMP_IF_TRUE,
+  // fused condition branches; all pop their operand(s)
+  OP_POP_JUMP_IF_FALSE,
+  OP_POP_JUMP_IF_TRUE,
+  OP_LESS_JUMP_FALSE,
+  OP_LESS_JUMP_TRUE,
+  OP_GREATER_JUMP_FALSE,
+  OP_GREATER_JUMP_TRUE,
+  OP_EQUAL_JUMP_FALSE,
+  OP_EQUAL_JUMP_TRUE,
   OP_LOOP,
   OP_CALL,
+  OP_TAIL_CALL,
   OP_INVOKE,
   OP_SUPER_INVOKE,
   OP_CLOSURE,
@@ -61,18 +78,52 @@ typedef struct {
   int count;
 } LineRun;
 
+// per-site inline cache for property access; what a site saw last time so the
+// next lookup can skip the hash probe
+typedef enum {
+  CACHE_EMPTY,
+  CACHE_FIELD,  // id is the receiver's shape, index is the field slot
+  CACHE_METHOD, // id is the class, shape the receiver's shape (a new field
+                // can shadow the method), payload the resolved closure
+  CACHE_INVOKE, // two-way: id/id2 are classes, payload/payload2 the closures,
+                // shape/shape2 the receiver shape when the entry was filled
+                // (any new field makes a new shape and kills the entry, which
+                // is what makes shadowing a method with a field safe)
+} CacheKind;
+
+typedef struct {
+  uint8_t kind;
+  uint32_t index;
+  void* id;
+  void* payload;
+  void* id2;
+  void* payload2;
+  // shapes aren't GC objects and live until VM shutdown, so these are
+  // compared but never marked
+  void* shape;
+  void* shape2;
+} InlineCache;
+
 typedef struct {
   int count;
   int capacity;
   uint8_t* code;
   LineRun* lines;
+  int lineRunCount;
   ValueArray constants;
+  InlineCache* caches;
+  int cacheCount;
+  int cacheCapacity;
+  bool mapped; // code and lines point into a bytecode file mapping; don't free
 } Chunk;
 
 void initChunk(Chunk* chunk);
 void freeChunk(Chunk* chunk);
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
+void rewindChunk(Chunk* chunk, int count);
 int addConstant(Chunk* chunk, Value value);
+int findConstant(Chunk* chunk, Value value);
+int addInlineCache(Chunk* chunk);
 void writeConstant(Chunk* chunk, Value value, int line);
 int getLine(Chunk* chunk, int instruction);
 
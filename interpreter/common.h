@@ -18,8 +18,17 @@ typedef enum {
 
 // DEV FLAGS
 #define NAN_BOXING // there's a chance your CPU architecture may not play nice with this flag, so turn it off if your Embr code seems to be running abnormally slow
+#define THREADED_DISPATCH // direct-threaded interpreter loop via GCC/Clang labels-as-values; ignored (portable switch fallback) on compilers without the extension
 // #define DEBUG_PRINT_CODE
 // #define DEBUG_TRACE_EXECUTION
+// #define DEBUG_STRESS_GC // collect on every allocation; brutal but great at flushing out missing GC roots
+// #define DEBUG_LOG_GC
+// #define DEBUG_PROFILE // count opcodes and sample call stacks; prints an opcode report and writes flamegraph-ready embr-profile.folded on exit
+// #define DEBUG_HEAP_STATS // track live objects and bytes per type and per allocating line; heapStats() gains per-type detail and a report prints on exit
+
+// GC TUNING
+#define GC_INITIAL_THRESHOLD (1024 * 1024) // heap size (in bytes) that triggers the first collection
+#define GC_HEAP_GROW_FACTOR 2 // after a collection, the next trigger is live bytes times this factor
 
 #define UINT8_COUNT (UINT8_MAX + 1)
 
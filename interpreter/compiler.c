@@ -6,7 +6,11 @@
 
 #include "common.h"
 #include "compiler.h"
+#include "ffi.h"
+#include "memory.h"
 #include "scanner.h"
+#include "stl.h"
+#include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #include "debug.h"
@@ -69,6 +73,10 @@ typedef struct Compiler {
   int localCount;
   Upvalue upvalues[UINT8_COUNT];
   int scopeDepth;
+
+  // highest offset any patched jump in this function lands on; tail rewrites
+  // must not rewind across it or the patched offset would point mid-instruction
+  int maxPatchTarget;
 } Compiler;
 
 typedef struct ClassCompiler {
@@ -76,9 +84,9 @@ typedef struct ClassCompiler {
   bool hasSuperclass;
 } ClassCompiler;
 
-Parser parser;
-Compiler* current = NULL;
-ClassCompiler* currentClass = NULL;
+_Thread_local Parser parser;
+_Thread_local Compiler* current = NULL;
+_Thread_local ClassCompiler* currentClass = NULL;
 
 static Chunk* currentChunk() {
   return &current->function->chunk;
@@ -158,6 +166,21 @@ static void emitLoop(int loopStart) {
   emitByte(offset & 0xff);
 }
 
+// fold-as-you-emit bookkeeping: where the most recent number literal, OP_NOT
+// and comparison landed, so binary()/unary()/emitConditionJump() can recognize
+// and rewrite foldable tails. The offset+chunk checks make stale entries
+// self-invalidate.
+static _Thread_local Chunk* lastNumberChunk = NULL;
+static _Thread_local int lastNumberOffset = -1;
+static _Thread_local double lastNumberValue = 0;
+static _Thread_local Chunk* lastNotChunk = NULL;
+static _Thread_local int lastNotOffset = -1;
+static _Thread_local Chunk* lastCompareChunk = NULL;
+static _Thread_local int lastCompareOffset = -1;
+static _Thread_local uint8_t lastCompareOp = OP_EQUAL;
+static _Thread_local Chunk* lastCallChunk = NULL;
+static _Thread_local int lastCallOffset = -1;
+
 static int emitJump(uint8_t instruction) {
   emitByte(instruction);
   emitByte(0xff);
@@ -165,6 +188,88 @@ static int emitJump(uint8_t instruction) {
   return currentChunk()->count - 2;
 }
 
+// Branch used by if/while/until/for conditions, where the tested value dies at
+// the branch. Fuses the condition's tail into a single pop-and-branch
+// instruction: a trailing OP_NOT just flips the branch polarity, and a trailing
+// comparison becomes one compare-and-branch opcode. 'and'/'or' keep plain
+// OP_JUMP_IF_FALSE because they leave the condition value on the stack.
+// Rewinding is only legal if no patched jump lands on or after the rewritten
+// byte (an 'and' inside the condition patches its exit to the condition's end).
+static int emitConditionJump() {
+  Chunk* chunk = currentChunk();
+  uint8_t instruction = OP_POP_JUMP_IF_FALSE;
+
+  // '!x' followed by branch-if-false is just branch-if-true on x
+  if (lastNotChunk == chunk && lastNotOffset == chunk->count - 1 &&
+      current->maxPatchTarget < lastNotOffset) {
+    rewindChunk(chunk, chunk->count - 1);
+    instruction = OP_POP_JUMP_IF_TRUE;
+  }
+
+  if (lastCompareChunk == chunk && lastCompareOffset == chunk->count - 1 &&
+      current->maxPatchTarget < lastCompareOffset) {
+    rewindChunk(chunk, chunk->count - 1);
+    bool jumpIfTrue = instruction == OP_POP_JUMP_IF_TRUE;
+    switch (lastCompareOp) {
+      case OP_LESS:
+        instruction = jumpIfTrue ? OP_LESS_JUMP_TRUE : OP_LESS_JUMP_FALSE;
+        break;
+      case OP_GREATER:
+        instruction = jumpIfTrue ? OP_GREATER_JUMP_TRUE : OP_GREATER_JUMP_FALSE;
+        break;
+      default:
+        instruction = jumpIfTrue ? OP_EQUAL_JUMP_TRUE : OP_EQUAL_JUMP_FALSE;
+        break;
+    }
+  }
+
+  emitByte(instruction);
+  emitByte(0xff);
+  emitByte(0xff);
+  return currentChunk()->count - 2;
+}
+
+static void emitCompare(uint8_t op) {
+  lastCompareChunk = currentChunk();
+  lastCompareOffset = currentChunk()->count;
+  lastCompareOp = op;
+  emitByte(op);
+}
+
+// Peephole for 'x = x + 1' / 'x = x - 1': when the right-hand side compiled to
+// exactly [get x][constant 1][add/subtract], the whole assignment collapses to
+// one increment instruction. Called from namedVariable() in place of the set
+// opcode; returns false when the shape doesn't match and the caller should
+// emit a plain set.
+static bool tryIncrement(uint8_t getOp, int arg, uint8_t incOp, uint8_t decOp) {
+  Chunk* chunk = currentChunk();
+  int getSize = getOp == OP_GET_GLOBAL ? 3 : 2;
+  int start = chunk->count - getSize - 3;
+  if (start < 0 || current->maxPatchTarget > start) return false;
+
+  uint8_t op = chunk->code[chunk->count - 1];
+  if (op != OP_ADD && op != OP_SUBTRACT) return false;
+  if (lastNumberChunk != chunk || lastNumberOffset != chunk->count - 3 ||
+      lastNumberValue != 1) return false;
+  if (chunk->code[start] != getOp) return false;
+  if (getSize == 2) {
+    if (chunk->code[start + 1] != (uint8_t)arg) return false;
+  } else if (chunk->code[start + 1] != ((arg >> 8) & 0xff) ||
+             chunk->code[start + 2] != (arg & 0xff)) {
+    return false;
+  }
+
+  rewindChunk(chunk, start);
+  emitByte(op == OP_ADD ? incOp : decOp);
+  if (getSize == 2) {
+    emitByte((uint8_t)arg);
+  } else {
+    emitByte((arg >> 8) & 0xff);
+    emitByte(arg & 0xff);
+  }
+  return true;
+}
+
 static void emitReturn() {
   if (current->type == TYPE_INITIALIZER) {
     emitBytes(OP_GET_LOCAL, 0);
@@ -189,6 +294,15 @@ static void emitConstant(Value value) {
   writeConstant(currentChunk(), value, parser.previous.line);
 }
 
+static void emitNumberConstant(double value) {
+  lastNumberChunk = currentChunk();
+  lastNumberOffset = currentChunk()->count;
+  lastNumberValue = value;
+  emitConstant(NUMBER_VAL(value));
+  // the folder only recognizes the two-byte OP_CONSTANT form
+  if (currentChunk()->count != lastNumberOffset + 2) lastNumberOffset = -1;
+}
+
 static void patchJump(int offset) {
   // -2 to adjust for the bytecode for the jump offset itself
   int jump = currentChunk()->count - offset - 2;
@@ -199,6 +313,10 @@ static void patchJump(int offset) {
 
   currentChunk()->code[offset] = (jump >> 8) & 0xff;
   currentChunk()->code[offset + 1] = jump & 0xff;
+
+  if (currentChunk()->count > current->maxPatchTarget) {
+    current->maxPatchTarget = currentChunk()->count;
+  }
 }
 
 static void initCompiler(Compiler* compiler, FunctionType type) {
@@ -207,6 +325,7 @@ static void initCompiler(Compiler* compiler, FunctionType type) {
   compiler->type = type;
   compiler->localCount = 0;
   compiler->scopeDepth = 0;
+  compiler->maxPatchTarget = 0;
   compiler->function = newFunction();
   current = compiler;
   if (type != TYPE_SCRIPT) {
@@ -269,6 +388,12 @@ static uint8_t identifierConstant(Token* name) {
   return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
 }
 
+// globals compile down to an index into vm.globalValues, so a global access
+// at runtime is an array load instead of a hash probe
+static uint16_t globalIdentifier(Token* name) {
+  return (uint16_t)globalSlot(copyString(name->start, name->length));
+}
+
 static ObjString* fetchImportName(Token* name) {
   return copyString(name->start, name->length);
 }
@@ -357,16 +482,71 @@ static void declareVariable() {
   addLocal(*name);
 }
 
-static uint8_t parseVariable(const char* errorMessage) {
+static uint16_t parseVariable(const char* errorMessage) {
   consume(TOKEN_IDENTIFIER, errorMessage);
 
   declareVariable();
   if (current->scopeDepth > 0) return 0;
 
-  return identifierConstant(&parser.previous);
+  return globalIdentifier(&parser.previous);
+}
+
+// direct imports of the script being compiled, recorded so a cached bytecode
+// file can replay them before running. Nested imports are handled by the
+// import's own compile, so only depth-one names are kept.
+static _Thread_local char** importNames = NULL;
+static _Thread_local int importNameCount = 0;
+static _Thread_local int importNameCapacity = 0;
+static _Thread_local int compileDepth = 0;
+
+static void recordImport(const char* name) {
+  if (importNameCount == importNameCapacity) {
+    importNameCapacity = importNameCapacity < 8 ? 8 : importNameCapacity * 2;
+    importNames = (char**)realloc(importNames,
+                                  sizeof(char*) * importNameCapacity);
+    if (importNames == NULL) exit(1);
+  }
+  importNames[importNameCount] = (char*)malloc(strlen(name) + 1);
+  if (importNames[importNameCount] == NULL) exit(1);
+  strcpy(importNames[importNameCount], name);
+  importNameCount++;
+}
+
+static void resetImports() {
+  for (int i = 0; i < importNameCount; i++) {
+    free(importNames[i]);
+  }
+  importNameCount = 0;
+}
+
+int compiledImportCount() {
+  return importNameCount;
+}
+
+const char* compiledImportName(int index) {
+  return importNames[index];
 }
 
 void loadFile(char* name) {
+  if (compileDepth == 1) recordImport(name);
+
+  // 'import native' records its name with a "native " prefix (identifiers
+  // can't contain spaces, so no script module can collide with one)
+  if (strncmp(name, "native ", 7) == 0) {
+    if (!loadNativeModule(name + 7)) exit(74);
+    return;
+  }
+
+  // standard modules ship inside the binary; only unknown names fall
+  // through to the filesystem
+  const char* embedded = stlModuleSource(name);
+  if (embedded != NULL) {
+    InterpretResult result = interpret(embedded);
+    if (result == INTERPRET_COMPILE_ERROR) exit(65);
+    if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+    return;
+  }
+
   if (strlen(name) + 4 >= 256) {
     fprintf(stderr, "File name is too long.\n");
     return;
@@ -423,6 +603,26 @@ void loadFile(char* name) {
 
 static uint8_t parseImport(const char* errorMessage) {
   consume(TOKEN_IDENTIFIER, errorMessage);
+
+  // 'import native foo;' loads a shared library instead of a script. The
+  // qualified name goes through loadFile so cached bytecode replays the
+  // registration the same way (a plain module can still be called "native":
+  // without a second identifier this is an ordinary import)
+  if (parser.previous.length == 6 &&
+      memcmp(parser.previous.start, "native", 6) == 0 &&
+      check(TOKEN_IDENTIFIER)) {
+    advance();
+    ObjString* lib = fetchImportName(&parser.previous);
+    char qualified[256];
+    snprintf(qualified, sizeof(qualified), "native %s", lib->chars);
+    loadFile(qualified);
+    // unlike a script import, loading a library leaves the parser intact, so
+    // the trailing ';' embr_native.h documents would become a parse error;
+    // accept it (and the bare form) here
+    match(TOKEN_SEMICOLON);
+    return 0;
+  }
+
   char* name = fetchImportName(&parser.previous)->chars;
   loadFile(name);
   return 0;
@@ -435,13 +635,15 @@ static void markInitialized() {
     current->scopeDepth;
 }
 
-static void defineVariable(uint8_t global) {
+static void defineVariable(uint16_t global) {
   if (current->scopeDepth > 0) {
     markInitialized();
     return;
   }
 
-  emitBytes(OP_DEFINE_GLOBAL, global);
+  emitByte(OP_DEFINE_GLOBAL);
+  emitByte((global >> 8) & 0xff);
+  emitByte(global & 0xff);
 }
 
 static uint8_t argumentList() {
@@ -468,18 +670,71 @@ static void and_(bool canAssign) {
   patchJump(endJump);
 }
 
+// tries to fold 'lhs op rhs' when both operands are the two number literals
+// sitting on the tail of the chunk; returns true if it rewrote the code
+static bool foldBinary(TokenType operatorType, bool lhsConstant, double lhs,
+                      int lhsOffset) {
+  Chunk* chunk = currentChunk();
+  if (!lhsConstant || lastNumberChunk != chunk ||
+      lastNumberOffset != chunk->count - 2 ||
+      lastNumberOffset != lhsOffset + 2) {
+    return false;
+  }
+  double rhs = lastNumberValue;
+
+  switch (operatorType) {
+    case TOKEN_PLUS:  rewindChunk(chunk, lhsOffset); emitNumberConstant(lhs + rhs); return true;
+    case TOKEN_MINUS: rewindChunk(chunk, lhsOffset); emitNumberConstant(lhs - rhs); return true;
+    case TOKEN_STAR:  rewindChunk(chunk, lhsOffset); emitNumberConstant(lhs * rhs); return true;
+    case TOKEN_SLASH: rewindChunk(chunk, lhsOffset); emitNumberConstant(lhs / rhs); return true;
+    case TOKEN_GREATER:       rewindChunk(chunk, lhsOffset); emitByte(lhs > rhs ? OP_TRUE : OP_FALSE); return true;
+    case TOKEN_GREATER_EQUAL: rewindChunk(chunk, lhsOffset); emitByte(lhs >= rhs ? OP_TRUE : OP_FALSE); return true;
+    case TOKEN_LESS:          rewindChunk(chunk, lhsOffset); emitByte(lhs < rhs ? OP_TRUE : OP_FALSE); return true;
+    case TOKEN_LESS_EQUAL:    rewindChunk(chunk, lhsOffset); emitByte(lhs <= rhs ? OP_TRUE : OP_FALSE); return true;
+    case TOKEN_EQUAL_EQUAL:   rewindChunk(chunk, lhsOffset); emitByte(lhs == rhs ? OP_TRUE : OP_FALSE); return true;
+    case TOKEN_BANG_EQUAL:    rewindChunk(chunk, lhsOffset); emitByte(lhs != rhs ? OP_TRUE : OP_FALSE); return true;
+    default: return false; // modulo and bitwise keep their runtime semantics
+  }
+}
+
 static void binary(bool canAssign) {
   TokenType operatorType = parser.previous.type;
   ParseRule* rule = getRule(operatorType);
+
+  Chunk* chunk = currentChunk();
+  int lhsOffset = chunk->count - 2;
+  bool lhsConstant = lhsOffset >= 0 && lastNumberChunk == chunk &&
+      lastNumberOffset == lhsOffset;
+  double lhs = lastNumberValue;
+
   parsePrecedence((Precedence)(rule->precedence + 1));
 
+  if (foldBinary(operatorType, lhsConstant, lhs, lhsOffset)) return;
+
+  // the negated comparisons desugar to a compare plus OP_NOT; mark the NOT
+  // so a following conditional jump can absorb it
   switch (operatorType) {
-    case TOKEN_BANG_EQUAL:    emitBytes(OP_EQUAL, OP_NOT); break;
-    case TOKEN_EQUAL_EQUAL:   emitByte(OP_EQUAL); break;
-    case TOKEN_GREATER:       emitByte(OP_GREATER); break;
-    case TOKEN_GREATER_EQUAL: emitBytes(OP_LESS, OP_NOT); break;
-    case TOKEN_LESS:          emitByte(OP_LESS); break;
-    case TOKEN_LESS_EQUAL:    emitBytes(OP_GREATER, OP_NOT); break;
+    case TOKEN_BANG_EQUAL:
+      emitCompare(OP_EQUAL);
+      lastNotChunk = currentChunk();
+      lastNotOffset = currentChunk()->count;
+      emitByte(OP_NOT);
+      break;
+    case TOKEN_EQUAL_EQUAL:   emitCompare(OP_EQUAL); break;
+    case TOKEN_GREATER:       emitCompare(OP_GREATER); break;
+    case TOKEN_GREATER_EQUAL:
+      emitCompare(OP_LESS);
+      lastNotChunk = currentChunk();
+      lastNotOffset = currentChunk()->count;
+      emitByte(OP_NOT);
+      break;
+    case TOKEN_LESS:          emitCompare(OP_LESS); break;
+    case TOKEN_LESS_EQUAL:
+      emitCompare(OP_GREATER);
+      lastNotChunk = currentChunk();
+      lastNotOffset = currentChunk()->count;
+      emitByte(OP_NOT);
+      break;
     case TOKEN_PLUS:          emitByte(OP_ADD); break;
     case TOKEN_MODULO:        emitByte(OP_MODULO); break;
     case TOKEN_MINUS:         emitByte(OP_SUBTRACT); break;
@@ -496,9 +751,23 @@ static void binary(bool canAssign) {
 
 static void call(bool canAssign) {
   uint8_t argCount = argumentList();
+  lastCallChunk = currentChunk();
+  lastCallOffset = currentChunk()->count;
   emitBytes(OP_CALL, argCount);
 }
 
+// reserves an inline cache slot for the access site being compiled and emits
+// its index as a two-byte operand
+static void emitInlineCache() {
+  int cache = addInlineCache(currentChunk());
+  if (cache > UINT16_MAX) {
+    error("Too many property accesses in one function.");
+    cache = 0;
+  }
+  emitByte((cache >> 8) & 0xff);
+  emitByte(cache & 0xff);
+}
+
 static void dot(bool canAssign) {
   consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
   uint8_t name = identifierConstant(&parser.previous);
@@ -506,12 +775,15 @@ static void dot(bool canAssign) {
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
     emitBytes(OP_SET_PROPERTY, name);
+    emitInlineCache();
   } else if (match(TOKEN_LEFT_PAREN)) {
     uint8_t argCount = argumentList();
     emitBytes(OP_INVOKE, name);
     emitByte(argCount);
+    emitInlineCache();
   } else {
     emitBytes(OP_GET_PROPERTY, name);
+    emitInlineCache();
   }
 }
 
@@ -531,7 +803,7 @@ static void grouping(bool canAssign) {
 
 static void number(bool canAssign) {
   double value = strtod(parser.previous.start, NULL);
-  emitConstant(NUMBER_VAL(value));
+  emitNumberConstant(value);
 }
 
 static void or_(bool canAssign) {
@@ -596,13 +868,28 @@ static void namedVariable(Token name, bool canAssign) {
     getOp = OP_GET_UPVALUE;
     setOp = OP_SET_UPVALUE;
   } else {
-    arg = identifierConstant(&name);
-    getOp = OP_GET_GLOBAL;
-    setOp = OP_SET_GLOBAL;
+    // globals take a two-byte slot operand
+    uint16_t slot = globalIdentifier(&name);
+    if (canAssign && match(TOKEN_EQUAL)) {
+      expression();
+      if (tryIncrement(OP_GET_GLOBAL, slot, OP_INC_GLOBAL, OP_DEC_GLOBAL)) {
+        return;
+      }
+      emitByte(OP_SET_GLOBAL);
+    } else {
+      emitByte(OP_GET_GLOBAL);
+    }
+    emitByte((slot >> 8) & 0xff);
+    emitByte(slot & 0xff);
+    return;
   }
-  
+
   if (canAssign && match(TOKEN_EQUAL)) {
     expression();
+    if (getOp == OP_GET_LOCAL &&
+        tryIncrement(OP_GET_LOCAL, arg, OP_INC_LOCAL, OP_DEC_LOCAL)) {
+      return;
+    }
     emitBytes(setOp, (uint8_t)arg);
   } else {
     emitBytes(getOp, (uint8_t)arg);
@@ -660,8 +947,22 @@ static void unary(bool canAssign) {
 
   // emit the operator instruction
   switch (operatorType) {
-    case TOKEN_BANG:  emitByte(OP_NOT); break;
-    case TOKEN_MINUS: emitByte(OP_NEGATE); break;
+    case TOKEN_BANG:
+      lastNotChunk = currentChunk();
+      lastNotOffset = currentChunk()->count;
+      emitByte(OP_NOT);
+      break;
+    case TOKEN_MINUS:
+      // fold negation of a number literal into the constant itself
+      if (lastNumberChunk == currentChunk() &&
+          lastNumberOffset == currentChunk()->count - 2) {
+        double value = -lastNumberValue;
+        currentChunk()->count -= 2;
+        emitNumberConstant(value);
+      } else {
+        emitByte(OP_NEGATE);
+      }
+      break;
     case TOKEN_BITWISE_NOT: emitByte(OP_BITWISE_NOT); break;
     default: return; // unreachable
   }
@@ -785,7 +1086,7 @@ static void function(FunctionType type) {
       if (current->function->arity > 255) {
         errorAtCurrent("Can't have more than 255 parameters.");
       }
-      uint8_t constant = parseVariable("Expect parameter name.");
+      uint16_t constant = parseVariable("Expect parameter name.");
       defineVariable(constant);
     } while (match(TOKEN_COMMA));
   }
@@ -834,10 +1135,12 @@ static void classDeclaration() {
   consume(TOKEN_IDENTIFIER, "Expect class name.");
   Token className = parser.previous;
   uint8_t nameConstant = identifierConstant(&parser.previous);
+  uint16_t global = current->scopeDepth > 0
+      ? 0 : globalIdentifier(&parser.previous);
   declareVariable();
 
   emitBytes(OP_CLASS, nameConstant);
-  defineVariable(nameConstant);
+  defineVariable(global);
 
   ClassCompiler classCompiler;
   classCompiler.hasSuperclass = false;
@@ -877,14 +1180,14 @@ static void classDeclaration() {
 }
 
 static void fnDeclaration() {
-  uint8_t global = parseVariable("Expect function name.");
+  uint16_t global = parseVariable("Expect function name.");
   markInitialized();
   function(TYPE_FUNCTION);
   defineVariable(global);
 }
 
 static void varDeclaration() {
-  uint8_t global = parseVariable("Expect variable name.");
+  uint16_t global = parseVariable("Expect variable name.");
 
   if (match(TOKEN_EQUAL)) {
     expression();
@@ -930,8 +1233,7 @@ static void forStatement() {
     consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
     // jump out of the loop if the condition is false
-    exitJump = emitJump(OP_JUMP_IF_FALSE);
-    emitByte(OP_POP); // condition
+    exitJump = emitConditionJump();
   }
   
   if (!match(TOKEN_RIGHT_PAREN)) {
@@ -951,7 +1253,6 @@ static void forStatement() {
 
   if (exitJump != -1) {
     patchJump(exitJump);
-    emitByte(OP_POP); // condition
   }
 
   endScope();
@@ -962,14 +1263,12 @@ static void ifStatement() {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-  int thenJump = emitJump(OP_JUMP_IF_FALSE);
-  emitByte(OP_POP);
+  int thenJump = emitConditionJump();
   statement();
 
   int elseJump = emitJump(OP_JUMP);
 
   patchJump(thenJump);
-  emitByte(OP_POP);
 
   if (match(TOKEN_ELSE)) statement();
   patchJump(elseJump);
@@ -1030,7 +1329,20 @@ static void returnStatement() {
         // no type checking required for TYPE_NONE
         break;
     }
-    
+
+    // a call that produces the return value directly is a tail call: rewrite
+    // it in place so the VM reuses the current frame. The opcode swap doesn't
+    // move any bytes, so jumps into the expression stay valid. Initializers
+    // are excluded (they must return the instance, not the callee's result)
+    // and so are typed returns (the caller's return-type check would be
+    // skipped along with its frame).
+    if ((current->type == TYPE_FUNCTION || current->type == TYPE_METHOD) &&
+        current->function->returnType == TYPE_NONE &&
+        lastCallChunk == currentChunk() &&
+        lastCallOffset == currentChunk()->count - 2) {
+      currentChunk()->code[lastCallOffset] = OP_TAIL_CALL;
+    }
+
     emitByte(OP_RETURN);
   }
 }
@@ -1041,13 +1353,11 @@ static void whileStatement() {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
-  int exitJump = emitJump(OP_JUMP_IF_FALSE);
-  emitByte(OP_POP);
+  int exitJump = emitConditionJump();
   statement();
   emitLoop(loopStart);
 
   patchJump(exitJump);
-  emitByte(OP_POP);
 }
 
 static void untilStatement() {
@@ -1056,15 +1366,16 @@ static void untilStatement() {
   expression();
   consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+  // mark the inversion so the condition jump absorbs it
+  lastNotChunk = currentChunk();
+  lastNotOffset = currentChunk()->count;
   emitByte(OP_NOT);
 
-  int exitJump = emitJump(OP_JUMP_IF_FALSE);
-  emitByte(OP_POP);
+  int exitJump = emitConditionJump();
   statement();
   emitLoop(loopStart);
 
   patchJump(exitJump);
-  emitByte(OP_POP);
 }
 
 static void synchronize() {
@@ -1129,7 +1440,17 @@ static void statement() {
   }
 }
 
+void markCompilerRoots() {
+  Compiler* compiler = current;
+  while (compiler != NULL) {
+    markObject((Obj*)compiler->function);
+    compiler = compiler->enclosing;
+  }
+}
+
 ObjFunction* compile(const char* source) {
+  if (compileDepth == 0) resetImports();
+  compileDepth++;
   initScanner(source);
   Compiler compiler;
   initCompiler(&compiler, TYPE_SCRIPT);
@@ -1144,5 +1465,6 @@ ObjFunction* compile(const char* source) {
   }
 
   ObjFunction* function = endCompiler();
+  compileDepth--;
   return parser.hadError ? NULL : function;
 }
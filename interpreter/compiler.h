@@ -5,5 +5,9 @@
 #include "vm.h"
 
 ObjFunction* compile(const char* source);
+void loadFile(char* name);
+int compiledImportCount();
+const char* compiledImportName(int index);
+void markCompilerRoots();
 
 #endif
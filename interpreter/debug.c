@@ -3,6 +3,7 @@
 #include "debug.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 void disassembleChunk(Chunk* chunk, const char* name) {
   printf("== %s ==\n", name);
@@ -30,6 +31,25 @@ static int constantLongInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 4;
 }
 
+static int propertyInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint16_t cache = (uint16_t)((chunk->code[offset + 2] << 8) |
+                              chunk->code[offset + 3]);
+  printf("%-16s %4d '", name, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' cache %d\n", cache);
+  return offset + 4;
+}
+
+static int globalInstruction(const char* name, Chunk* chunk, int offset) {
+  uint16_t slot = (uint16_t)((chunk->code[offset + 1] << 8) |
+                            chunk->code[offset + 2]);
+  printf("%-16s %4d '", name, slot);
+  printValue(vm.globalNames.values[slot]);
+  printf("'\n");
+  return offset + 3;
+}
+
 static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
   uint8_t constant = chunk->code[offset + 1];
   uint8_t argCount = chunk->code[offset + 2];
@@ -39,6 +59,17 @@ static int invokeInstruction(const char* name, Chunk* chunk, int offset) {
   return offset + 3;
 }
 
+static int invokeCacheInstruction(const char* name, Chunk* chunk, int offset) {
+  uint8_t constant = chunk->code[offset + 1];
+  uint8_t argCount = chunk->code[offset + 2];
+  uint16_t cache = (uint16_t)((chunk->code[offset + 3] << 8) |
+                              chunk->code[offset + 4]);
+  printf("%-16s (%d args) %4d '", name, argCount, constant);
+  printValue(chunk->constants.values[constant]);
+  printf("' cache %d\n", cache);
+  return offset + 5;
+}
+
 int disassembleInstruction(Chunk* chunk, int offset) {
   printf("%04d ", offset);
   int line = getLine(chunk, offset);
@@ -66,20 +97,28 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return byteInstruction("OP_GET_LOCAL", chunk, offset);
     case OP_SET_LOCAL:
       return byteInstruction("OP_SET_LOCAL", chunk, offset);
+    case OP_INC_LOCAL:
+      return byteInstruction("OP_INC_LOCAL", chunk, offset);
+    case OP_DEC_LOCAL:
+      return byteInstruction("OP_DEC_LOCAL", chunk, offset);
     case OP_GET_GLOBAL:
-      return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+      return globalInstruction("OP_GET_GLOBAL", chunk, offset);
     case OP_DEFINE_GLOBAL:
-      return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+      return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
     case OP_SET_GLOBAL:
-      return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+      return globalInstruction("OP_SET_GLOBAL", chunk, offset);
+    case OP_INC_GLOBAL:
+      return globalInstruction("OP_INC_GLOBAL", chunk, offset);
+    case OP_DEC_GLOBAL:
+      return globalInstruction("OP_DEC_GLOBAL", chunk, offset);
     case OP_GET_UPVALUE:
       return byteInstruction("OP_GET_UPVALUE", chunk, offset);
     case OP_SET_UPVALUE:
       return byteInstruction("OP_SET_UPVALUE", chunk, offset);
     case OP_GET_PROPERTY:
-      return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+      return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
     case OP_SET_PROPERTY:
-      return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+      return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
     case OP_GET_SUPER:
       return constantInstruction("OP_GET_SUPER", chunk, offset);
     case OP_EQUAL:
@@ -120,12 +159,32 @@ int disassembleInstruction(Chunk* chunk, int offset) {
       return jumpInstruction("OP_JUMP", 1, chunk, offset);
     case OP_JUMP_IF_FALSE:
       return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_JUMP_IF_TRUE:
+      return jumpInstruction("OP_JUMP_IF_TRUE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_FALSE:
+      return jumpInstruction("OP_POP_JUMP_IF_FALSE", 1, chunk, offset);
+    case OP_POP_JUMP_IF_TRUE:
+      return jumpInstruction("OP_POP_JUMP_IF_TRUE", 1, chunk, offset);
+    case OP_LESS_JUMP_FALSE:
+      return jumpInstruction("OP_LESS_JUMP_FALSE", 1, chunk, offset);
+    case OP_LESS_JUMP_TRUE:
+      return jumpInstruction("OP_LESS_JUMP_TRUE", 1, chunk, offset);
+    case OP_GREATER_JUMP_FALSE:
+      return jumpInstruction("OP_GREATER_JUMP_FALSE", 1, chunk, offset);
+    case OP_GREATER_JUMP_TRUE:
+      return jumpInstruction("OP_GREATER_JUMP_TRUE", 1, chunk, offset);
+    case OP_EQUAL_JUMP_FALSE:
+      return jumpInstruction("OP_EQUAL_JUMP_FALSE", 1, chunk, offset);
+    case OP_EQUAL_JUMP_TRUE:
+      return jumpInstruction("OP_EQUAL_JUMP_TRUE", 1, chunk, offset);
     case OP_LOOP:
       return jumpInstruction("OP_LOOP", -1, chunk, offset);
     case OP_CALL:
       return byteInstruction("OP_CALL", chunk, offset);
+    case OP_TAIL_CALL:
+      return byteInstruction("OP_TAIL_CALL", chunk, offset);
     case OP_INVOKE:
-      return invokeInstruction("OP_INVOKE", chunk, offset);
+      return invokeCacheInstruction("OP_INVOKE", chunk, offset);
     case OP_SUPER_INVOKE:
       return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
     case OP_CLOSURE: {
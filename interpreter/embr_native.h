@@ -0,0 +1,76 @@
+#ifndef embr_native_h
+#define embr_native_h
+
+// Public ABI for native Embr modules. This is the only header a module
+// needs; it deliberately exposes nothing about the VM's internals. Build a
+// module as a shared library exporting embrModuleInit:
+//
+//   #include "embr_native.h"
+//   static EmbrValue twice(int argCount, EmbrValue* args) { ... }
+//   void embrModuleInit(const EmbrHostApi* api) {
+//     embr = api;
+//     api->defineNative("twice", twice);
+//   }
+//
+//   gcc -shared -fPIC twice.c -o native/twice.so
+//
+// and load it from a script with:
+//
+//   import native twice;
+//
+// Keep the api pointer the host hands you; it stays valid for the life of
+// the process.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// bump when the layout of EmbrHostApi changes; modules built against a
+// newer ABI than the host can refuse to register in embrModuleInit
+#define EMBR_ABI_VERSION 1
+
+// an Embr value, bit-for-bit. The representation is opaque; go through the
+// host API to build or inspect one.
+typedef uint64_t EmbrValue;
+
+// the calling convention native functions use: args points at argCount
+// values and the return value is handed back to the script
+typedef EmbrValue (*EmbrNativeFn)(int argCount, EmbrValue* args);
+
+typedef struct {
+  int abiVersion; // EMBR_ABI_VERSION of the host
+
+  // registers a global function visible to scripts under the given name
+  void (*defineNative)(const char* name, EmbrNativeFn function);
+
+  // numbers
+  EmbrValue (*numberValue)(double number);
+  bool (*isNumber)(EmbrValue value);
+  double (*asNumber)(EmbrValue value);
+
+  // booleans and nil
+  EmbrValue (*boolValue)(bool boolean);
+  bool (*isBool)(EmbrValue value);
+  bool (*asBool)(EmbrValue value);
+  EmbrValue (*nilValue)(void);
+  bool (*isNil)(EmbrValue value);
+
+  // strings. The chars pointer is owned by the VM and stays valid as long
+  // as the value it came from is reachable; copy it if you need to keep it.
+  // stringValue copies its input, which may run the garbage collector --
+  // argument values are safe (they live on the VM stack), but don't hold
+  // unrooted values you made earlier across the call.
+  EmbrValue (*stringValue)(const char* chars, int length);
+  bool (*isString)(EmbrValue value);
+  const char* (*asCString)(EmbrValue value);
+  int (*stringLength)(EmbrValue value);
+
+  // reports a runtime error with a stack trace, like a failed native
+  // argument check inside the VM; return nilValue() afterwards
+  void (*error)(const char* message);
+} EmbrHostApi;
+
+// every module exports this; the host calls it once per VM the module is
+// imported into, so registration must be repeatable
+typedef void (*EmbrModuleInit)(const EmbrHostApi* api);
+
+#endif
@@ -0,0 +1,48 @@
+#include <dlfcn.h>
+#include <stdio.h>
+
+#include "embr_native.h"
+#include "ffi.h"
+#include "vm.h"
+
+// search order mirrors script imports: a project-local native/ directory,
+// then the working directory, then the system linker path via lib<name>.so
+static void* openModule(const char* name) {
+  char path[256];
+  void* handle;
+
+  snprintf(path, sizeof(path), "./native/%s.so", name);
+  handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle != NULL) return handle;
+
+  snprintf(path, sizeof(path), "./%s.so", name);
+  handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (handle != NULL) return handle;
+
+  snprintf(path, sizeof(path), "lib%s.so", name);
+  return dlopen(path, RTLD_NOW | RTLD_LOCAL);
+}
+
+bool loadNativeModule(const char* name) {
+  void* handle = openModule(name);
+  if (handle == NULL) {
+    fprintf(stderr, "Failed to load native module \"%s\": %s\n", name,
+            dlerror());
+    return false;
+  }
+
+  // dlopen refcounts, so importing the same module into successive VMs
+  // reuses the mapping; the handle is never closed because registered
+  // natives keep pointing into it
+  EmbrModuleInit init;
+  *(void**)&init = dlsym(handle, "embrModuleInit");
+  if (init == NULL) {
+    fprintf(stderr, "Native module \"%s\" does not export embrModuleInit.\n",
+            name);
+    dlclose(handle);
+    return false;
+  }
+
+  init(embrHostApi());
+  return true;
+}
@@ -0,0 +1,11 @@
+#ifndef embr_ffi_h
+#define embr_ffi_h
+
+#include "common.h"
+
+// loads the shared library behind 'import native <name>' and runs its
+// embrModuleInit. Returns false (after printing why) when the library
+// can't be found or doesn't export the entry point.
+bool loadNativeModule(const char* name);
+
+#endif
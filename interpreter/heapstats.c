@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "heapstats.h"
+#include "object.h"
+#include "vm.h"
+
+#ifdef DEBUG_HEAP_STATS
+
+#define OBJ_TYPE_COUNT (OBJ_FLOAT_ARRAY + 1)
+
+// one row per ObjType: what's alive right now, the most that was ever alive,
+// and how much was allocated over the whole run. Bytes here are the object
+// headers themselves; variable payloads (string characters, array buffers)
+// go through reallocate and show up in the total heap figures instead.
+typedef struct {
+  size_t liveCount;
+  size_t liveBytes;
+  size_t peakBytes;
+  uint64_t totalAllocs;
+} TypeStats;
+
+// allocation sites accumulate as "function:line" rows. Distinct allocating
+// lines are bounded by program size, so a linear scan per allocation is fine
+// for an instrumentation build.
+typedef struct {
+  char* where;
+  uint64_t count;
+  size_t bytes;
+} SiteStats;
+
+// per-VM like the rest of the interpreter
+static _Thread_local TypeStats typeStats[OBJ_TYPE_COUNT];
+static _Thread_local size_t peakHeapBytes = 0;
+static _Thread_local SiteStats* sites = NULL;
+static _Thread_local int siteCount = 0;
+static _Thread_local int siteCapacity = 0;
+
+static const char* typeNames[OBJ_TYPE_COUNT] = {
+  [OBJ_BOUND_METHOD] = "boundMethod",
+  [OBJ_CLASS] = "class",
+  [OBJ_CLOSURE] = "closure",
+  [OBJ_FUNCTION] = "function",
+  [OBJ_INSTANCE] = "instance",
+  [OBJ_NATIVE] = "native",
+  [OBJ_STRING] = "string",
+  [OBJ_UPVALUE] = "upvalue",
+  [OBJ_ARRAY] = "array",
+  [OBJ_DICT] = "dict",
+  [OBJ_FLOAT_ARRAY] = "floatArray",
+};
+
+// mirrors the sizes freeObject hands to freeObjectMemory, so live bytes
+// balance back to zero when every object dies
+static size_t objectBaseSize(ObjType type) {
+  switch (type) {
+    case OBJ_BOUND_METHOD: return sizeof(ObjBoundMethod);
+    case OBJ_CLASS:        return sizeof(ObjClass);
+    case OBJ_CLOSURE:      return sizeof(ObjClosure);
+    case OBJ_FUNCTION:     return sizeof(ObjFunction);
+    case OBJ_INSTANCE:     return sizeof(ObjInstance);
+    case OBJ_NATIVE:       return sizeof(ObjNative);
+    case OBJ_STRING:       return sizeof(ObjString);
+    case OBJ_UPVALUE:      return sizeof(ObjUpvalue);
+    case OBJ_ARRAY:        return sizeof(ObjArray);
+    case OBJ_DICT:         return sizeof(ObjDict);
+    case OBJ_FLOAT_ARRAY:  return sizeof(ObjFloatArray);
+  }
+  return 0; // unreachable
+}
+
+// attributes an allocation to the script line executing it. Every opcode
+// that can allocate spills its registers first (allocation can trigger a
+// collection, which needs vm.stackTop coherent), so the top frame's ip is
+// trustworthy here. Allocations with no Embr frame on the stack -- compiling,
+// VM startup -- aren't script-attributable and are skipped.
+static void recordSite(size_t size) {
+  if (vm.frameCount == 0) return;
+  CallFrame* frame = &vm.frames[vm.frameCount - 1];
+  ObjFunction* function = frame->closure->function;
+  const char* name = function->name != NULL ? function->name->chars : "script";
+  int offset = (int)(frame->ip - function->chunk.code);
+  int line = getLine(&function->chunk, offset);
+
+  char where[256];
+  snprintf(where, sizeof(where), "%s:%d", name, line);
+  for (int i = 0; i < siteCount; i++) {
+    if (strcmp(sites[i].where, where) == 0) {
+      sites[i].count++;
+      sites[i].bytes += size;
+      return;
+    }
+  }
+
+  if (siteCount == siteCapacity) {
+    siteCapacity = siteCapacity < 64 ? 64 : siteCapacity * 2;
+    sites = (SiteStats*)realloc(sites, sizeof(SiteStats) * siteCapacity);
+    if (sites == NULL) exit(1);
+  }
+  sites[siteCount].where = strdup(where);
+  sites[siteCount].count = 1;
+  sites[siteCount].bytes = size;
+  siteCount++;
+}
+
+void heapStatsAllocObject(Obj* object, size_t size) {
+  TypeStats* row = &typeStats[object->type];
+  row->liveCount++;
+  row->liveBytes += size;
+  row->totalAllocs++;
+  if (row->liveBytes > row->peakBytes) row->peakBytes = row->liveBytes;
+  recordSite(size);
+}
+
+void heapStatsFreeObject(Obj* object) {
+  TypeStats* row = &typeStats[object->type];
+  row->liveCount--;
+  row->liveBytes -= objectBaseSize(object->type);
+}
+
+void heapStatsNoteHeap() {
+  if (vm.bytesAllocated > peakHeapBytes) peakHeapBytes = vm.bytesAllocated;
+}
+
+static int compareSiteBytes(const void* a, const void* b) {
+  size_t bytesA = ((const SiteStats*)a)->bytes;
+  size_t bytesB = ((const SiteStats*)b)->bytes;
+  return (bytesA < bytesB) - (bytesA > bytesB);
+}
+
+void heapStatsDump() {
+  fprintf(stderr, "== heap: %zu bytes live, peak %zu, next GC at %zu ==\n",
+          vm.bytesAllocated, peakHeapBytes, vm.nextGC);
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    TypeStats* row = &typeStats[i];
+    if (row->totalAllocs == 0) continue;
+    fprintf(stderr, "%-12s %10zu live %10zu bytes (peak %10zu, %llu allocs)\n",
+            typeNames[i], row->liveCount, row->liveBytes, row->peakBytes,
+            (unsigned long long)row->totalAllocs);
+  }
+
+  if (siteCount > 0) {
+    qsort(sites, siteCount, sizeof(SiteStats), compareSiteBytes);
+    fprintf(stderr, "== allocation sites ==\n");
+    int shown = siteCount < 20 ? siteCount : 20;
+    for (int i = 0; i < shown; i++) {
+      fprintf(stderr, "%-32s %12llu allocs %12zu bytes\n", sites[i].where,
+              (unsigned long long)sites[i].count, sites[i].bytes);
+    }
+  }
+
+  for (int i = 0; i < siteCount; i++) free(sites[i].where);
+  free(sites);
+  sites = NULL;
+  siteCount = 0;
+  siteCapacity = 0;
+}
+
+#endif
+
+static void dictSetNumber(ObjDict* dict, const char* name, double number) {
+  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  writeDict(dict, vm.stackTop[-1], NUMBER_VAL(number));
+  pop();
+}
+
+Value heapStatsNative(int argCount, Value* args) {
+  (void)args;
+  if (argCount != 0) {
+    embrHostApi()->error("SKILL ISSUE: heapStats() takes no arguments.");
+    return NIL_VAL;
+  }
+
+  ObjDict* dict = newDict();
+  push(OBJ_VAL(dict));
+  dictSetNumber(dict, "bytes", (double)vm.bytesAllocated);
+  dictSetNumber(dict, "nextGC", (double)vm.nextGC);
+
+  #ifdef DEBUG_HEAP_STATS
+  dictSetNumber(dict, "peakBytes", (double)peakHeapBytes);
+  for (int i = 0; i < OBJ_TYPE_COUNT; i++) {
+    TypeStats* row = &typeStats[i];
+    dictSetNumber(dict, typeNames[i], (double)row->liveCount);
+    char key[32];
+    snprintf(key, sizeof(key), "%sBytes", typeNames[i]);
+    dictSetNumber(dict, key, (double)row->liveBytes);
+  }
+  #endif
+
+  return pop();
+}
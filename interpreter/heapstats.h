@@ -0,0 +1,24 @@
+#ifndef embr_heapstats_h
+#define embr_heapstats_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+#ifdef DEBUG_HEAP_STATS
+
+// hooks for the allocation choke points: allocateObject tells us the type,
+// reallocate and allocateObjectMemory move vm.bytesAllocated so they note
+// the heap high-water mark
+void heapStatsAllocObject(Obj* object, size_t size);
+void heapStatsFreeObject(Obj* object);
+void heapStatsNoteHeap();
+void heapStatsDump();
+
+#endif
+
+// always registered; reports live/peak totals and, when DEBUG_HEAP_STATS is
+// on, per-type live counts and bytes
+Value heapStatsNative(int argCount, Value* args);
+
+#endif
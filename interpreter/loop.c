@@ -0,0 +1,240 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "memory.h"
+#include "object.h"
+#include "vm.h"
+
+#define WATCH_CHUNK 4096
+
+// one scheduled callback; a task either has a deadline (timers, with
+// interval > 0 for repeating ones) or an fd to watch for readability
+typedef struct LoopTask {
+  int id;
+  ObjClosure* closure;
+  double deadline; // monotonic seconds; already-due tasks run next turn
+  double interval; // seconds between repeats, 0 for one-shot
+  int fd;          // -1 for timers
+  struct LoopTask* next;
+} LoopTask;
+
+// the loop is per-VM like everything else in the interpreter
+static _Thread_local LoopTask* loopTasks = NULL;
+static _Thread_local int nextTaskId = 1;
+
+static double monotonicSeconds() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
+}
+
+static int addTask(ObjClosure* closure, double deadline, double interval,
+                   int fd) {
+  LoopTask* task = (LoopTask*)malloc(sizeof(LoopTask));
+  if (task == NULL) exit(1);
+  task->id = nextTaskId++;
+  task->closure = closure;
+  task->deadline = deadline;
+  task->interval = interval;
+  task->fd = fd;
+  task->next = loopTasks;
+  loopTasks = task;
+  return task->id;
+}
+
+static bool removeTask(int id) {
+  LoopTask** link = &loopTasks;
+  while (*link != NULL) {
+    if ((*link)->id == id) {
+      LoopTask* task = *link;
+      *link = task->next;
+      free(task);
+      return true;
+    }
+    link = &(*link)->next;
+  }
+  return false;
+}
+
+static void loopError(const char* message) {
+  embrHostApi()->error(message);
+}
+
+Value deferNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_CLOSURE(args[0])) {
+    loopError("SKILL ISSUE: defer() takes exactly 1 argument: a function.");
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((double)addTask(AS_CLOSURE(args[0]), 0, 0, -1));
+}
+
+Value delayNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_NUMBER(args[0]) || !IS_CLOSURE(args[1])) {
+    loopError("SKILL ISSUE: delay() takes exactly 2 arguments: milliseconds and a function.");
+    return NIL_VAL;
+  }
+  double deadline = monotonicSeconds() + AS_NUMBER(args[0]) / 1000.0;
+  return NUMBER_VAL((double)addTask(AS_CLOSURE(args[1]), deadline, 0, -1));
+}
+
+Value everyNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_NUMBER(args[0]) || !IS_CLOSURE(args[1]) ||
+      AS_NUMBER(args[0]) <= 0) {
+    loopError("SKILL ISSUE: every() takes a positive number of milliseconds and a function.");
+    return NIL_VAL;
+  }
+  double interval = AS_NUMBER(args[0]) / 1000.0;
+  return NUMBER_VAL((double)addTask(AS_CLOSURE(args[1]),
+                                    monotonicSeconds() + interval, interval,
+                                    -1));
+}
+
+Value cancelNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_NUMBER(args[0])) {
+    loopError("SKILL ISSUE: cancel() takes exactly 1 argument: a task id.");
+    return NIL_VAL;
+  }
+  return BOOL_VAL(removeTask((int)AS_NUMBER(args[0])));
+}
+
+Value watchNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0 ||
+      !IS_CLOSURE(args[1])) {
+    loopError("SKILL ISSUE: watch() takes exactly 2 arguments: a file descriptor and a function.");
+    return NIL_VAL;
+  }
+  int fd = (int)AS_NUMBER(args[0]);
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    loopError("SKILL ISSUE: watch() could not make the descriptor non-blocking.");
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((double)addTask(AS_CLOSURE(args[1]), 0, 0, fd));
+}
+
+// runs one task's callback. The task is unlinked first (and a repeating
+// timer relinked with a fresh deadline, keeping its id) so the callback can
+// defer, delay or cancel freely -- including cancelling its own repeat.
+static bool runTimerTask(int id) {
+  LoopTask** link = &loopTasks;
+  while (*link != NULL && (*link)->id != id) link = &(*link)->next;
+  if (*link == NULL) return true; // cancelled by an earlier callback
+
+  LoopTask* task = *link;
+  *link = task->next;
+  ObjClosure* closure = task->closure;
+  if (task->interval > 0) {
+    task->deadline = monotonicSeconds() + task->interval;
+    task->next = loopTasks;
+    loopTasks = task;
+  } else {
+    free(task);
+  }
+
+  Value ignored;
+  return runClosure(closure, 0, NULL, &ignored);
+}
+
+static bool runWatchTask(int id) {
+  LoopTask** link = &loopTasks;
+  while (*link != NULL && (*link)->id != id) link = &(*link)->next;
+  if (*link == NULL) return true;
+  LoopTask* task = *link;
+  ObjClosure* closure = task->closure;
+
+  char buffer[WATCH_CHUNK];
+  ssize_t bytes = read(task->fd, buffer, sizeof(buffer));
+  if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+    return true; // spurious wakeup; keep waiting
+  }
+
+  Value chunk = NIL_VAL;
+  if (bytes > 0) {
+    chunk = OBJ_VAL(copyString(buffer, (int)bytes));
+  } else {
+    // end-of-file (or a read error, which ends the stream the same way)
+    *link = task->next;
+    free(task);
+  }
+  Value ignored;
+  return runClosure(closure, 1, &chunk, &ignored);
+}
+
+InterpretResult runEventLoop() {
+  while (loopTasks != NULL) {
+    // snapshot what's runnable before polling; callbacks reshape the list
+    int dueCapacity = 0;
+    for (LoopTask* task = loopTasks; task != NULL; task = task->next) {
+      dueCapacity++;
+    }
+    int* dueIds = (int*)malloc(sizeof(int) * dueCapacity);
+    struct pollfd* fds =
+        (struct pollfd*)malloc(sizeof(struct pollfd) * dueCapacity);
+    int* fdIds = (int*)malloc(sizeof(int) * dueCapacity);
+    if (dueIds == NULL || fds == NULL || fdIds == NULL) exit(1);
+
+    double now = monotonicSeconds();
+    int dueCount = 0;
+    int fdCount = 0;
+    int timeoutMs = -1;
+    for (LoopTask* task = loopTasks; task != NULL; task = task->next) {
+      if (task->fd >= 0) {
+        fds[fdCount].fd = task->fd;
+        fds[fdCount].events = POLLIN;
+        fds[fdCount].revents = 0;
+        fdIds[fdCount++] = task->id;
+      } else if (task->deadline <= now) {
+        dueIds[dueCount++] = task->id;
+      } else {
+        int wait = (int)((task->deadline - now) * 1000.0) + 1;
+        if (timeoutMs < 0 || wait < timeoutMs) timeoutMs = wait;
+      }
+    }
+
+    if (dueCount > 0) timeoutMs = 0;
+    // whatever the callbacks printed should be visible before we block, for
+    // the same reason interpret() flushes before the REPL's next prompt
+    vmOutFlush();
+    poll(fds, (nfds_t)fdCount, timeoutMs);
+
+    bool ok = true;
+    for (int i = 0; i < dueCount && ok; i++) {
+      ok = runTimerTask(dueIds[i]);
+    }
+    for (int i = 0; i < fdCount && ok; i++) {
+      // POLLNVAL means the fd was closed while watched (a native module can
+      // do that); the read below fails and ends the stream like EOF, instead
+      // of the loop spinning on a task that never matches
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) {
+        ok = runWatchTask(fdIds[i]);
+      }
+    }
+
+    free(dueIds);
+    free(fds);
+    free(fdIds);
+    if (!ok) return INTERPRET_RUNTIME_ERROR;
+  }
+  return INTERPRET_OK;
+}
+
+// scheduled callbacks are the only references some closures have left
+void markLoopRoots() {
+  for (LoopTask* task = loopTasks; task != NULL; task = task->next) {
+    markObject((Obj*)task->closure);
+  }
+}
+
+void freeEventLoop() {
+  while (loopTasks != NULL) {
+    LoopTask* task = loopTasks;
+    loopTasks = task->next;
+    free(task);
+  }
+}
@@ -0,0 +1,30 @@
+#ifndef embr_loop_h
+#define embr_loop_h
+
+#include "vm.h"
+
+// Per-VM event loop. Scripts schedule work through natives:
+//
+//   defer(f)      run f() on the next loop turn, returns a task id
+//   delay(ms, f)  run f() once after ms milliseconds
+//   every(ms, f)  run f() every ms milliseconds until cancelled
+//   cancel(id)    drop a scheduled task; true if it was still pending
+//   watch(fd, f)  make fd non-blocking and call f(chunk) whenever it has
+//                 bytes to read; f(nil) on end-of-file removes the watch
+//
+// Nothing runs while the script body is on the stack: runEventLoop() drains
+// the queue after the script returns (runFile and worker threads both drive
+// it), polling fds and sleeping until the nearest timer instead of spinning.
+
+Value deferNative(int argCount, Value* args);
+Value delayNative(int argCount, Value* args);
+Value everyNative(int argCount, Value* args);
+Value cancelNative(int argCount, Value* args);
+Value watchNative(int argCount, Value* args);
+
+// drains scheduled tasks; stops at the first callback that errors
+InterpretResult runEventLoop();
+void markLoopRoots();
+void freeEventLoop();
+
+#endif
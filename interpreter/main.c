@@ -1,14 +1,25 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include "bench.h"
 #include "compiler.h"
+#include "serialize.h"
 #include "memory.h"
 #include "common.h"
 #include "chunk.h"
 #include "debug.h"
+#include "loop.h"
 #include "object.h"
 #include "vm.h"
 
+// runs a compiled script and then drains whatever it scheduled on the
+// event loop (timers, deferred callbacks, fd watches)
+static void runScript(ObjFunction* function) {
+  if (interpretFunction(function) == INTERPRET_RUNTIME_ERROR) exit(70);
+  if (runEventLoop() == INTERPRET_RUNTIME_ERROR) exit(70);
+}
+
 static void repl() {
   char line[1024];
   for (;;) {
@@ -19,7 +30,9 @@ static void repl() {
       break;
     }
 
-    interpret(line);
+    if (interpret(line) == INTERPRET_OK) {
+      runEventLoop(); // anything the line scheduled runs before the next prompt
+    }
   }
 }
 
@@ -53,22 +66,63 @@ static char* readFile(const char* path) {
 }
 
 static void runFile(const char* path) {
-  // restrict files to those that contain a .mbr extension
+  // restrict files to those that contain a .mbr or .mbc extension
   const char* extension = strrchr(path, '.');
-  if (extension == NULL || strcmp(extension, ".mbr") != 0) {
+  if (extension == NULL ||
+      (strcmp(extension, ".mbr") != 0 && strcmp(extension, ".mbc") != 0)) {
     fprintf(stderr, "Error: File must be an Embr code file (.mbr extension).\n");
     exit(74);
   }
-  
+
+  // running a compiled file directly skips the source checks
+  if (strcmp(extension, ".mbc") == 0) {
+    ObjFunction* function = loadBytecodeFile(path, 0);
+    if (function == NULL) {
+      fprintf(stderr, "Could not load bytecode file \"%s\".\n", path);
+      exit(74);
+    }
+    runScript(function);
+    return;
+  }
+
+  // sources run through a .mbc cache next to the file: reuse it when its
+  // recorded source mtime still matches, otherwise recompile and refresh it
+  char cachePath[512];
+  struct stat sourceStat;
+  bool haveCachePath =
+      strlen(path) + 1 < sizeof(cachePath) && stat(path, &sourceStat) == 0;
+  if (haveCachePath) {
+    snprintf(cachePath, sizeof(cachePath), "%.*s.mbc",
+            (int)(extension - path), path);
+    ObjFunction* cached =
+        loadBytecodeFile(cachePath, (uint64_t)sourceStat.st_mtime);
+    if (cached != NULL) {
+      runScript(cached);
+      return;
+    }
+  }
+
   char* source = readFile(path);
-  InterpretResult result = interpret(source);
+  ObjFunction* function = compile(source);
   free(source);
+  if (function == NULL) exit(65);
 
-  if (result == INTERPRET_COMPILE_ERROR) exit(65);
-  if (result == INTERPRET_RUNTIME_ERROR) exit(70);
+  if (haveCachePath) {
+    // best effort; an unwritable directory just means compiling next time too
+    writeBytecodeFile(cachePath, (uint64_t)sourceStat.st_mtime, function);
+  }
+
+  runScript(function);
 }
 
 int main(int argc, const char* argv[]) {
+  if (argc >= 3 && argc <= 5 && strcmp(argv[1], "--bench") == 0) {
+    // benchmark iterations each build their own VM, so skip the usual one
+    int warmup = argc > 3 ? atoi(argv[3]) : 1;
+    int iterations = argc > 4 ? atoi(argv[4]) : 5;
+    return runBenchmarks(argv[2], warmup, iterations);
+  }
+
   initVM();
 
   // loadStandardLibrary();
@@ -77,8 +131,30 @@ int main(int argc, const char* argv[]) {
     repl();
   } else if (argc == 2) {
     runFile(argv[1]);
+  } else if (argc == 4 && strcmp(argv[1], "--snapshot") == 0) {
+    // run the warmup script, then image the heap for later --restore runs
+    runFile(argv[3]);
+    if (!writeSnapshotFile(argv[2])) {
+      fprintf(stderr, "Could not write snapshot \"%s\".\n", argv[2]);
+      exit(74);
+    }
+  } else if ((argc == 3 || argc == 4) &&
+            strcmp(argv[1], "--restore") == 0) {
+    if (!loadSnapshotFile(argv[2])) {
+      fprintf(stderr, "Could not load snapshot \"%s\".\n", argv[2]);
+      exit(74);
+    }
+    if (argc == 4) {
+      runFile(argv[3]);
+    } else {
+      repl();
+    }
   } else {
-    fprintf(stderr, "Usage: embr [path]\n");
+    fprintf(stderr,
+            "Usage: embr [path]\n"
+            "       embr --snapshot image.mbi path\n"
+            "       embr --restore image.mbi [path]\n"
+            "       embr --bench dir [warmup [iterations]]\n");
     exit(64);
   }
 
@@ -1,9 +1,132 @@
 #include <stdlib.h>
 
+#include "compiler.h"
+#include "heapstats.h"
+#include "loop.h"
 #include "memory.h"
 #include "vm.h"
 
+#ifdef DEBUG_LOG_GC
+#include <stdio.h>
+#include "debug.h"
+#endif
+
+// Objects are carved out of bump-allocated pages instead of hitting malloc
+// once per object. Freed objects go onto a free list for their size class and
+// get handed back out on the next allocation, so short-lived objects recycle
+// the same hot cache lines. Pages are only returned to the OS at shutdown.
+#define OBJECT_PAGE_SIZE (64 * 1024)
+#define OBJECT_CELL_ALIGN 16
+#define OBJECT_MAX_SMALL 512
+#define OBJECT_SIZE_CLASSES (OBJECT_MAX_SMALL / OBJECT_CELL_ALIGN)
+
+typedef struct ObjectPage {
+  struct ObjectPage* next;
+} ObjectPage;
+
+typedef struct FreeCell {
+  struct FreeCell* next;
+} FreeCell;
+
+static _Thread_local ObjectPage* objectPages = NULL;
+static _Thread_local char* bumpPtr = NULL;
+static _Thread_local char* bumpEnd = NULL;
+static _Thread_local FreeCell* freeLists[OBJECT_SIZE_CLASSES];
+
+static size_t roundToCell(size_t size) {
+  return (size + OBJECT_CELL_ALIGN - 1) & ~(size_t)(OBJECT_CELL_ALIGN - 1);
+}
+
+void* allocateObjectMemory(size_t size) {
+  vm.bytesAllocated += size;
+
+  #ifdef DEBUG_HEAP_STATS
+  heapStatsNoteHeap();
+  #endif
+
+  #ifdef DEBUG_STRESS_GC
+  collectGarbage();
+  #endif
+
+  if (vm.bytesAllocated > vm.nextGC) {
+    collectGarbage();
+  }
+
+  size_t rounded = roundToCell(size);
+  if (rounded > OBJECT_MAX_SMALL) {
+    void* result = malloc(size);
+    if (result == NULL) exit(1);
+    return result;
+  }
+
+  int sizeClass = (int)(rounded / OBJECT_CELL_ALIGN) - 1;
+  FreeCell* cell = freeLists[sizeClass];
+  if (cell != NULL) {
+    freeLists[sizeClass] = cell->next;
+    return cell;
+  }
+
+  if (bumpPtr == NULL || bumpPtr + rounded > bumpEnd) {
+    ObjectPage* page = (ObjectPage*)malloc(OBJECT_PAGE_SIZE);
+    if (page == NULL) exit(1);
+    page->next = objectPages;
+    objectPages = page;
+    bumpPtr = (char*)page + roundToCell(sizeof(ObjectPage));
+    bumpEnd = (char*)page + OBJECT_PAGE_SIZE;
+  }
+
+  void* result = bumpPtr;
+  bumpPtr += rounded;
+  return result;
+}
+
+void freeObjectMemory(void* pointer, size_t size) {
+  vm.bytesAllocated -= size;
+
+  size_t rounded = roundToCell(size);
+  if (rounded > OBJECT_MAX_SMALL) {
+    free(pointer);
+    return;
+  }
+
+  int sizeClass = (int)(rounded / OBJECT_CELL_ALIGN) - 1;
+  FreeCell* cell = (FreeCell*)pointer;
+  cell->next = freeLists[sizeClass];
+  freeLists[sizeClass] = cell;
+}
+
+static void freeObjectPages() {
+  ObjectPage* page = objectPages;
+  while (page != NULL) {
+    ObjectPage* next = page->next;
+    free(page);
+    page = next;
+  }
+  objectPages = NULL;
+  bumpPtr = NULL;
+  bumpEnd = NULL;
+  for (int i = 0; i < OBJECT_SIZE_CLASSES; i++) {
+    freeLists[i] = NULL;
+  }
+}
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
+  vm.bytesAllocated += newSize - oldSize;
+
+  #ifdef DEBUG_HEAP_STATS
+  heapStatsNoteHeap();
+  #endif
+
+  if (newSize > oldSize) {
+    #ifdef DEBUG_STRESS_GC
+    collectGarbage();
+    #endif
+
+    if (vm.bytesAllocated > vm.nextGC) {
+      collectGarbage();
+    }
+  }
+
   if (newSize == 0) {
     free(pointer);
     return NULL;
@@ -14,63 +137,270 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
   return result;
 }
 
+void markObject(Obj* object) {
+  if (object == NULL) return;
+  if (object->isMarked) return;
+
+  #ifdef DEBUG_LOG_GC
+  printf("%p mark ", (void*)object);
+  printValue(OBJ_VAL(object));
+  printf("\n");
+  #endif
+
+  object->isMarked = true;
+
+  if (vm.grayCapacity < vm.grayCount + 1) {
+    vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+    // the gray stack uses raw realloc so growing it can't recursively kick off
+    // another collection
+    vm.grayStack = (Obj**)realloc(vm.grayStack, sizeof(Obj*) * vm.grayCapacity);
+    if (vm.grayStack == NULL) exit(1);
+  }
+
+  vm.grayStack[vm.grayCount++] = object;
+}
+
+void markValue(Value value) {
+  if (IS_OBJ(value)) markObject(AS_OBJ(value));
+}
+
+static void markValueArray(ValueArray* array) {
+  for (int i = 0; i < array->count; i++) {
+    markValue(array->values[i]);
+  }
+}
+
+static void blackenObject(Obj* object) {
+  #ifdef DEBUG_LOG_GC
+  printf("%p blacken ", (void*)object);
+  printValue(OBJ_VAL(object));
+  printf("\n");
+  #endif
+
+  switch (object->type) {
+    case OBJ_ARRAY: {
+      ObjArray* array = (ObjArray*)object;
+      for (int i = 0; i < array->count; i++) {
+        markValue(array->values[i]);
+      }
+      markObject((Obj*)array->origin);
+      break;
+    }
+    case OBJ_DICT: {
+      ObjDict* dict = (ObjDict*)object;
+      markValueTable(&dict->items);
+      break;
+    }
+    case OBJ_FLOAT_ARRAY:
+      break; // raw doubles, no children
+
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod* bound = (ObjBoundMethod*)object;
+      markValue(bound->receiver);
+      markObject((Obj*)bound->method);
+      break;
+    }
+    case OBJ_CLASS: {
+      ObjClass* klass = (ObjClass*)object;
+      markObject((Obj*)klass->name);
+      markTable(&klass->methods);
+      break;
+    }
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*)object;
+      markObject((Obj*)closure->function);
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        markObject((Obj*)closure->upvalues[i]);
+      }
+      break;
+    }
+    case OBJ_FUNCTION: {
+      ObjFunction* function = (ObjFunction*)object;
+      markObject((Obj*)function->name);
+      markObject((Obj*)function->sharedClosure);
+      markValueArray(&function->chunk.constants);
+      // method caches keep their class and closure alive so a cache hit can
+      // never see a recycled address; field caches are validated against live
+      // data and need no marking
+      for (int i = 0; i < function->chunk.cacheCount; i++) {
+        InlineCache* cache = &function->chunk.caches[i];
+        if (cache->kind == CACHE_METHOD || cache->kind == CACHE_INVOKE) {
+          markObject((Obj*)cache->id);
+          markObject((Obj*)cache->payload);
+          markObject((Obj*)cache->id2);
+          markObject((Obj*)cache->payload2);
+        }
+      }
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      markObject((Obj*)instance->klass);
+      for (int i = 0; i < instance->shape->fieldCount; i++) {
+        markValue(instance->fields[i]);
+      }
+      break;
+    }
+    case OBJ_UPVALUE:
+      markValue(((ObjUpvalue*)object)->closed);
+      break;
+    case OBJ_NATIVE:
+    case OBJ_STRING:
+      break;
+  }
+}
+
 static void freeObject(Obj* object) {
+  #ifdef DEBUG_LOG_GC
+  printf("%p free type %d\n", (void*)object, object->type);
+  #endif
+
+  #ifdef DEBUG_HEAP_STATS
+  heapStatsFreeObject(object);
+  #endif
+
   switch (object->type) {
     case OBJ_ARRAY: {
       ObjArray* array = (ObjArray*)object;
-      freeValueArray(&array->elements);
-      FREE(ObjArray, object);
+      if (array->buffer != NULL) {
+        FREE_ARRAY(Value, array->buffer, array->capacity);
+      }
+      freeObjectMemory(object, sizeof(ObjArray));
       break;
     }
     case OBJ_DICT: {
       ObjDict* dict = (ObjDict*)object;
-      freeTable(&dict->items);
-      FREE(ObjDict, object);
+      freeValueTable(&dict->items);
+      freeObjectMemory(object, sizeof(ObjDict));
+      break;
+    }
+    case OBJ_FLOAT_ARRAY: {
+      ObjFloatArray* array = (ObjFloatArray*)object;
+      FREE_ARRAY(double, array->values, array->count);
+      freeObjectMemory(object, sizeof(ObjFloatArray));
       break;
     }
     case OBJ_BOUND_METHOD:
-      FREE(ObjBoundMethod, object);
+      freeObjectMemory(object, sizeof(ObjBoundMethod));
       break;
     case OBJ_CLASS: {
       ObjClass* klass = (ObjClass*)object;
       freeTable(&klass->methods);
-      FREE(ObjClass, object);
+      freeObjectMemory(object, sizeof(ObjClass));
       break;
-    } 
+    }
     case OBJ_CLOSURE: {
       ObjClosure* closure = (ObjClosure*)object;
       FREE_ARRAY(ObjUpvalue*, closure->upvalues,
                 closure->upvalueCount);
-      FREE(ObjClosure, object);
+      freeObjectMemory(object, sizeof(ObjClosure));
       break;
     }
     case OBJ_FUNCTION: {
       ObjFunction* function = (ObjFunction*)object;
       freeChunk(&function->chunk);
-      FREE(ObjFunction, object);
+      freeObjectMemory(object, sizeof(ObjFunction));
       break;
     }
     case OBJ_INSTANCE: {
       ObjInstance* instance = (ObjInstance*)object;
-      freeTable(&instance->fields);
-      FREE(ObjInstance, object);
+      FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+      freeObjectMemory(object, sizeof(ObjInstance));
       break;
     }
     case OBJ_NATIVE:
-      FREE(ObjNative, object);
+      freeObjectMemory(object, sizeof(ObjNative));
       break;
     case OBJ_STRING: {
       ObjString* string = (ObjString*)object;
       FREE_ARRAY(char, string->chars, string->length + 1);
-      FREE(ObjString, object);
+      freeObjectMemory(object, sizeof(ObjString));
       break;
     }
     case OBJ_UPVALUE:
-      FREE(ObjUpvalue, object);
+      freeObjectMemory(object, sizeof(ObjUpvalue));
       break;
   }
 }
 
+static void markRoots() {
+  for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+    markValue(*slot);
+  }
+
+  for (int i = 0; i < vm.frameCount; i++) {
+    markObject((Obj*)vm.frames[i].closure);
+  }
+
+  for (ObjUpvalue* upvalue = vm.openUpvalues;
+      upvalue != NULL;
+      upvalue = upvalue->next) {
+    markObject((Obj*)upvalue);
+  }
+
+  markTable(&vm.globals);
+  markValueArray(&vm.globalValues);
+  markValueArray(&vm.globalNames);
+  // shape slot tables hold the interned field names
+  for (Shape* shape = vm.shapes; shape != NULL; shape = shape->next) {
+    markTable(&shape->slots);
+  }
+  markCompilerRoots();
+  markLoopRoots();
+  markObject((Obj*)vm.initString);
+}
+
+static void traceReferences() {
+  while (vm.grayCount > 0) {
+    Obj* object = vm.grayStack[--vm.grayCount];
+    blackenObject(object);
+  }
+}
+
+static void sweep() {
+  Obj* previous = NULL;
+  Obj* object = vm.objects;
+  while (object != NULL) {
+    if (object->isMarked) {
+      object->isMarked = false;
+      previous = object;
+      object = object->next;
+    } else {
+      Obj* unreached = object;
+      object = object->next;
+      if (previous != NULL) {
+        previous->next = object;
+      } else {
+        vm.objects = object;
+      }
+
+      freeObject(unreached);
+    }
+  }
+}
+
+void collectGarbage() {
+  #ifdef DEBUG_LOG_GC
+  printf("-- gc begin\n");
+  size_t before = vm.bytesAllocated;
+  #endif
+
+  markRoots();
+  traceReferences();
+  // the intern table holds every string, so unreferenced entries have to be
+  // dropped before the sweep frees them out from under it
+  tableRemoveWhite(&vm.strings);
+  sweep();
+
+  vm.nextGC = vm.bytesAllocated * GC_HEAP_GROW_FACTOR;
+
+  #ifdef DEBUG_LOG_GC
+  printf("-- gc end\n");
+  printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+        before - vm.bytesAllocated, before, vm.bytesAllocated, vm.nextGC);
+  #endif
+}
+
 void freeObjects() {
   Obj* object = vm.objects;
   while (object != NULL) {
@@ -78,4 +408,7 @@ void freeObjects() {
     freeObject(object);
     object = next;
   }
+
+  freeObjectPages();
+  free(vm.grayStack);
 }
@@ -20,6 +20,11 @@
   reallocate(pointer, sizeof(type) * (oldCount), 0)
 
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
+void* allocateObjectMemory(size_t size);
+void freeObjectMemory(void* pointer, size_t size);
+void markObject(Obj* object);
+void markValue(Value value);
+void collectGarbage();
 void freeObjects();
 
 #endif
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "heapstats.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -11,12 +12,21 @@
     (type*)allocateObject(sizeof(type), objectType)
 
 static Obj* allocateObject(size_t size, ObjType type) {
-  Obj* object = (Obj*)reallocate(NULL, 0, size);
+  Obj* object = (Obj*)allocateObjectMemory(size);
   object->type = type;
+  object->isMarked = false;
 
   object->next = vm.objects;
   vm.objects = object;
 
+  #ifdef DEBUG_HEAP_STATS
+  heapStatsAllocObject(object, size);
+  #endif
+
+  #ifdef DEBUG_LOG_GC
+  printf("%p allocate %zu for %d\n", (void*)object, size, type);
+  #endif
+
   return object;
 }
 
@@ -55,6 +65,7 @@ ObjFunction* newFunction() {
   function->arity = 0;
   function->upvalueCount = 0;
   function->name = NULL;
+  function->sharedClosure = NULL;
   initChunk(&function->chunk);
   return function;
 }
@@ -62,10 +73,92 @@ ObjFunction* newFunction() {
 ObjInstance* newInstance(ObjClass* klass) {
   ObjInstance* instance = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
   instance->klass = klass;
-  initTable(&instance->fields);
+  instance->shape = vm.rootShape;
+  instance->fields = NULL;
+  instance->fieldCapacity = 0;
   return instance;
 }
 
+Shape* newShape() {
+  Shape* shape = ALLOCATE(Shape, 1);
+  shape->fieldCount = 0;
+  initTable(&shape->slots);
+  shape->transitions = NULL;
+  shape->next = vm.shapes;
+  vm.shapes = shape;
+  return shape;
+}
+
+void freeShapes() {
+  Shape* shape = vm.shapes;
+  while (shape != NULL) {
+    Shape* next = shape->next;
+    ShapeTransition* transition = shape->transitions;
+    while (transition != NULL) {
+      ShapeTransition* nextTransition = transition->next;
+      FREE(ShapeTransition, transition);
+      transition = nextTransition;
+    }
+    freeTable(&shape->slots);
+    FREE(Shape, shape);
+    shape = next;
+  }
+  vm.shapes = NULL;
+  vm.rootShape = NULL;
+}
+
+// follows (or creates) the transition edge for adding a field
+static Shape* shapeTransition(Shape* shape, ObjString* name) {
+  for (ShapeTransition* transition = shape->transitions;
+      transition != NULL;
+      transition = transition->next) {
+    if (transition->name == name) return transition->child;
+  }
+
+  Shape* child = newShape();
+  child->fieldCount = shape->fieldCount + 1;
+  tableAddAll(&shape->slots, &child->slots);
+  tableSet(&child->slots, name, NUMBER_VAL((double)shape->fieldCount));
+
+  ShapeTransition* transition = ALLOCATE(ShapeTransition, 1);
+  transition->name = name;
+  transition->child = child;
+  transition->next = shape->transitions;
+  shape->transitions = transition;
+  return child;
+}
+
+int shapeFieldSlot(Shape* shape, ObjString* name) {
+  Value slot;
+  if (!tableGet(&shape->slots, name, &slot)) return -1;
+  return (int)AS_NUMBER(slot);
+}
+
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value) {
+  int slot = shapeFieldSlot(instance->shape, name);
+  if (slot < 0) return false;
+  *value = instance->fields[slot];
+  return true;
+}
+
+void instanceSetField(ObjInstance* instance, ObjString* name, Value value) {
+  int slot = shapeFieldSlot(instance->shape, name);
+  if (slot < 0) {
+    Shape* shape = shapeTransition(instance->shape, name);
+    slot = shape->fieldCount - 1;
+    if (slot >= instance->fieldCapacity) {
+      int oldCapacity = instance->fieldCapacity;
+      instance->fieldCapacity = GROW_CAPACITY(oldCapacity);
+      instance->fields = GROW_ARRAY(Value, instance->fields, oldCapacity,
+                                    instance->fieldCapacity);
+    }
+    // the shape only advances once the slot array can hold the new field, so
+    // a collection during the grow still sees a consistent layout
+    instance->shape = shape;
+  }
+  instance->fields[slot] = value;
+}
+
 ObjNative* newNative(NativeFn function) {
   ObjNative* native = ALLOCATE_OBJ(ObjNative, OBJ_NATIVE);
   native->function = function;
@@ -85,13 +178,31 @@ static ObjString* allocateString(char* chars, int length, uint32_t hash) {
   return string;
 }
 
+// Word-at-a-time multiply-xor hash. Eight bytes per round instead of FNV-1a's
+// one, which matters because every string gets hashed on creation for the
+// intern table. The Swiss-style probing in table.c also consumes the top bits
+// as a control fragment, so the final mix spreads entropy across the whole
+// word before folding to 32 bits.
 static uint32_t hashString(const char* key, int length) {
-  uint32_t hash = 2166136261u;
-  for (int i = 0; i < length; i++) {
-    hash ^= (uint8_t)key[i];
-    hash *= 16777619;
+  uint64_t hash = 0x9e3779b97f4a7c15ull ^ (uint64_t)length;
+  const char* p = key;
+  int remaining = length;
+  while (remaining >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    hash = (hash ^ word) * 0x2545f4914f6cdd1dull;
+    p += 8;
+    remaining -= 8;
   }
-  return hash;
+  if (remaining > 0) {
+    uint64_t word = 0;
+    memcpy(&word, p, remaining);
+    hash = (hash ^ word) * 0x2545f4914f6cdd1dull;
+  }
+  hash ^= hash >> 32;
+  hash *= 0x2545f4914f6cdd1dull;
+  hash ^= hash >> 29;
+  return (uint32_t)hash;
 }
 
 ObjString* takeString(char* chars, int length) {
@@ -119,26 +230,116 @@ ObjString* copyString(const char* chars, int length) {
 
 ObjArray* newArray() {
   ObjArray* array = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
-  initValueArray(&array->elements);
+  array->values = NULL;
+  array->count = 0;
+  array->buffer = NULL;
+  array->capacity = 0;
+  array->origin = NULL;
   return array;
 }
 
+// gives the array its own buffer with 'frontSlack' free slots before the
+// window and 'backSlack' after it. This is also how a view detaches from its
+// owner: afterwards the array owns its storage outright.
+static void arrayReserve(ObjArray* array, int frontSlack, int backSlack) {
+  int capacity = frontSlack + array->count + backSlack;
+  Value* buffer = ALLOCATE(Value, capacity);
+  if (array->count > 0) {
+    memcpy(buffer + frontSlack, array->values, sizeof(Value) * array->count);
+  }
+  if (array->buffer != NULL) {
+    FREE_ARRAY(Value, array->buffer, array->capacity);
+  }
+  array->buffer = buffer;
+  array->capacity = capacity;
+  array->values = buffer + frontSlack;
+  array->origin = NULL;
+}
+
+// called before any in-place write: a view must never touch the shared buffer
+void privatizeArray(ObjArray* array) {
+  if (array->origin == NULL) return;
+  arrayReserve(array, 0, 0);
+}
+
 void writeArray(ObjArray* array, Value value) {
-  writeValueArray(&array->elements, value);
+  if (array->origin != NULL ||
+      array->values + array->count == array->buffer + array->capacity) {
+    arrayReserve(array, 0, GROW_CAPACITY(array->count) - array->count);
+  }
+  array->values[array->count++] = value;
+}
+
+void prependArray(ObjArray* array, Value value) {
+  if (array->origin != NULL || array->values == array->buffer) {
+    arrayReserve(array, GROW_CAPACITY(array->count) - array->count, 0);
+  }
+  array->values--;
+  array->values[0] = value;
+  array->count++;
+}
+
+// O(1) rest: hands out a view one element in. The first view moves the buffer
+// to a hidden owner object, so the original array becomes a view too and a
+// later write to it copies it out instead of disturbing its views.
+ObjArray* restArray(ObjArray* array) {
+  if (array->origin == NULL) {
+    ObjArray* owner = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+    owner->values = array->values;
+    owner->count = array->count;
+    owner->buffer = array->buffer;
+    owner->capacity = array->capacity;
+    owner->origin = NULL;
+    array->buffer = NULL;
+    array->capacity = 0;
+    array->origin = owner;
+  }
+
+  ObjArray* view = ALLOCATE_OBJ(ObjArray, OBJ_ARRAY);
+  view->values = array->values + 1;
+  view->count = array->count - 1;
+  view->buffer = NULL;
+  view->capacity = 0;
+  view->origin = array->origin;
+  return view;
 }
 
 Value readArray(ObjArray* array, int index) {
-  if (index >= 0 && index < array->elements.count) {
-    return array->elements.values[index];
+  if (index >= 0 && index < array->count) {
+    return array->values[index];
   }
   return NIL_VAL;
 }
 
 void printArray(ObjArray* array) {
   printf("[");
-  for (int i = 0; i < array->elements.count; i++) {
-    printValue(array->elements.values[i]);
-    if (i < array->elements.count - 1) {
+  for (int i = 0; i < array->count; i++) {
+    printValue(array->values[i]);
+    if (i < array->count - 1) {
+      printf(", ");
+    }
+  }
+  printf("]");
+}
+
+ObjFloatArray* newFloatArray(int count) {
+  ObjFloatArray* array = ALLOCATE_OBJ(ObjFloatArray, OBJ_FLOAT_ARRAY);
+  array->count = 0;
+  array->values = NULL;
+  // the buffer allocation can trigger a collection; keep the shell reachable
+  push(FLOAT_ARRAY_VAL(array));
+  array->values = ALLOCATE(double, count);
+  array->count = count;
+  for (int i = 0; i < count; i++) array->values[i] = 0;
+  pop();
+  return array;
+}
+
+void printFloatArray(ObjFloatArray* array) {
+  printf("[");
+  for (int i = 0; i < array->count; i++) {
+    printValue(NUMBER_VAL(array->values[i]));
+    if (i < array->count - 1) {
       printf(", ");
     }
   }
@@ -147,17 +348,17 @@ void printArray(ObjArray* array) {
 
 ObjDict* newDict() {
   ObjDict* dict = ALLOCATE_OBJ(ObjDict, OBJ_DICT);
-  initTable(&dict->items);
+  initValueTable(&dict->items);
   return dict;
 }
 
-void writeDict(ObjDict* dict, ObjString* key, Value value) {
-  tableSet(&dict->items, key, value);
+void writeDict(ObjDict* dict, Value key, Value value) {
+  valueTableSet(&dict->items, key, value);
 }
 
-Value readDict(ObjDict* dict, ObjString* key) {
+Value readDict(ObjDict* dict, Value key) {
   Value value;
-  if (tableGet(&dict->items, key, &value)) {
+  if (valueTableGet(&dict->items, key, &value)) {
     return value;
   }
   return NIL_VAL;
@@ -167,13 +368,13 @@ void printDict(ObjDict* dict) {
   printf("{");
   bool first = true;
   for (int i = 0; i < dict->items.capacity; i++) {
-    Entry* entry = &dict->items.entries[i];
-    if (entry->key != NULL) {
+    ValueEntry* entry = &dict->items.entries[i];
+    if (!IS_UNDEFINED(entry->key)) {
       if (!first) {
         printf(", ");
       }
       first = false;
-      printValue(OBJ_VAL(entry->key));
+      printValue(entry->key);
       printf(": ");
       printValue(entry->value);
     }
@@ -230,5 +431,8 @@ void printObject(Value value) {
     case OBJ_DICT:
       printDict(AS_DICT(value));
       break;
+    case OBJ_FLOAT_ARRAY:
+      printFloatArray(AS_FLOAT_ARRAY(value));
+      break;
   }
 }
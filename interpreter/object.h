@@ -37,10 +37,12 @@ typedef enum {
   OBJ_UPVALUE,
   OBJ_ARRAY,
   OBJ_DICT,
+  OBJ_FLOAT_ARRAY,
 } ObjType;
 
 struct Obj {
   ObjType type;
+  bool isMarked;
   struct Obj* next;
 };
 
@@ -51,6 +53,9 @@ typedef struct {
   Chunk chunk;
   ObjString* name;
   FunctionReturnType returnType;
+  // capture-free functions close over nothing, so every OP_CLOSURE for them
+  // can hand out this one shared closure instead of allocating a fresh one
+  struct ObjClosure* sharedClosure;
 } ObjFunction;
 
 typedef Value (*NativeFn)(int argCount, Value* args);
@@ -74,7 +79,7 @@ typedef struct ObjUpvalue {
   struct ObjUpvalue* next;
 } ObjUpvalue;
 
-typedef struct {
+typedef struct ObjClosure {
   Obj obj;
   ObjFunction* function;
   ObjUpvalue** upvalues;
@@ -87,10 +92,31 @@ typedef struct {
   Table methods;
 } ObjClass;
 
+// hidden class describing an instance's field layout. Instances that gain the
+// same fields in the same order share a shape, so a (shape, slot) pair fully
+// identifies where a field lives and the inline caches can key on the shape
+// pointer alone. Shapes form a tree: adding a field follows (or creates) a
+// transition edge to the child shape. They live outside the GC heap and are
+// only released at shutdown.
+typedef struct ShapeTransition {
+  ObjString* name;
+  struct Shape* child;
+  struct ShapeTransition* next;
+} ShapeTransition;
+
+typedef struct Shape {
+  int fieldCount;
+  Table slots; // field name -> slot index (stored as a number Value)
+  ShapeTransition* transitions;
+  struct Shape* next; // every shape, for root marking and shutdown
+} Shape;
+
 typedef struct {
   Obj obj;
   ObjClass* klass;
-  Table fields; 
+  Shape* shape;
+  Value* fields;
+  int fieldCapacity;
 } ObjInstance;
 
 typedef struct {
@@ -99,18 +125,40 @@ typedef struct {
   ObjClosure* method;
 } ObjBoundMethod;
 
-typedef struct {
+// an array is a window [values, values+count) onto a heap buffer. It either
+// owns the buffer ('buffer' non-NULL, with slack allowed on both sides so the
+// window can grow either way) or is a view into another array's buffer
+// ('origin' non-NULL, held only to keep the owner alive for the GC).
+// head/tail/rest just move the window, which makes the functional list idioms
+// O(1) with shared storage; any write to a view copies it out first, so
+// aliasing is never observable.
+typedef struct ObjArray {
   Obj obj;
-  ValueArray elements;
+  Value* values;
+  int count;
+  Value* buffer;           // owned allocation, NULL for views
+  int capacity;            // owned allocation size
+  struct ObjArray* origin; // buffer owner, NULL for owners
 } ObjArray;
 
 typedef struct {
   Obj obj;
-  Table items;
+  ValueTable items;
 } ObjDict;
 
+// fixed-length contiguous float64 buffer. Elements are raw doubles rather
+// than boxed Values, so bulk numeric kernels run over plain memory and the
+// compiler can vectorize them.
+typedef struct {
+  Obj obj;
+  int count;
+  double* values;
+} ObjFloatArray;
+
 ObjDict* newDict();
 ObjArray* newArray();
+ObjFloatArray* newFloatArray(int count);
+void printFloatArray(ObjFloatArray* array);
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 ObjClass* newClass(ObjString* name);
 ObjClosure* newClosure(ObjFunction* function);
@@ -120,13 +168,21 @@ ObjNative* newNative(NativeFn function);
 ObjString* takeString(char* chars, int length);
 ObjString* copyString(const char* chars, int length);
 ObjUpvalue* newUpvalue(Value* slot);
+Shape* newShape();
+void freeShapes();
+int shapeFieldSlot(Shape* shape, ObjString* name);
+bool instanceGetField(ObjInstance* instance, ObjString* name, Value* value);
+void instanceSetField(ObjInstance* instance, ObjString* name, Value value);
 void printObject(Value value);
 void writeArray(ObjArray* array, Value value);
+void prependArray(ObjArray* array, Value value);
+void privatizeArray(ObjArray* array);
+ObjArray* restArray(ObjArray* array);
 void printArray(ObjArray* array);
 Value readArray(ObjArray* array, int index);
-void writeDict(ObjDict* dict, ObjString* key, Value value);
+void writeDict(ObjDict* dict, Value key, Value value);
 void printDict(ObjDict* dict);
-Value readDict(ObjDict* dict, ObjString* key);
+Value readDict(ObjDict* dict, Value key);
 
 static inline bool isObjType(Value value, ObjType type) {
   return IS_OBJ(value) && AS_OBJ(value)->type == type;
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk.h"
+#include "object.h"
+#include "profile.h"
+#include "vm.h"
+
+#ifdef DEBUG_PROFILE
+
+uint64_t profileOpcodeCounts[UINT8_COUNT];
+int profileSampleCountdown = PROFILE_SAMPLE_INTERVAL;
+
+// collapsed stacks accumulate as strings and get merged at dump time; at one
+// sample per 4096 instructions even long runs stay small
+static char** samples = NULL;
+static int sampleCount = 0;
+static int sampleCapacity = 0;
+
+static const char* opcodeNames[UINT8_COUNT] = {
+  [OP_CONSTANT] = "OP_CONSTANT",
+  [OP_CONSTANT_LONG] = "OP_CONSTANT_LONG",
+  [OP_NIL] = "OP_NIL",
+  [OP_TRUE] = "OP_TRUE",
+  [OP_FALSE] = "OP_FALSE",
+  [OP_POP] = "OP_POP",
+  [OP_GET_LOCAL] = "OP_GET_LOCAL",
+  [OP_SET_LOCAL] = "OP_SET_LOCAL",
+  [OP_INC_LOCAL] = "OP_INC_LOCAL",
+  [OP_DEC_LOCAL] = "OP_DEC_LOCAL",
+  [OP_GET_GLOBAL] = "OP_GET_GLOBAL",
+  [OP_DEFINE_GLOBAL] = "OP_DEFINE_GLOBAL",
+  [OP_SET_GLOBAL] = "OP_SET_GLOBAL",
+  [OP_INC_GLOBAL] = "OP_INC_GLOBAL",
+  [OP_DEC_GLOBAL] = "OP_DEC_GLOBAL",
+  [OP_GET_UPVALUE] = "OP_GET_UPVALUE",
+  [OP_SET_UPVALUE] = "OP_SET_UPVALUE",
+  [OP_GET_PROPERTY] = "OP_GET_PROPERTY",
+  [OP_SET_PROPERTY] = "OP_SET_PROPERTY",
+  [OP_GET_SUPER] = "OP_GET_SUPER",
+  [OP_EQUAL] = "OP_EQUAL",
+  [OP_GREATER] = "OP_GREATER",
+  [OP_LESS] = "OP_LESS",
+  [OP_ADD] = "OP_ADD",
+  [OP_SUBTRACT] = "OP_SUBTRACT",
+  [OP_MULTIPLY] = "OP_MULTIPLY",
+  [OP_DIVIDE] = "OP_DIVIDE",
+  [OP_MODULO] = "OP_MODULO",
+  [OP_NOT] = "OP_NOT",
+  [OP_NEGATE] = "OP_NEGATE",
+  [OP_OUT] = "OP_OUT",
+  [OP_JUMP] = "OP_JUMP",
+  [OP_JUMP_IF_FALSE] = "OP_JUMP_IF_FALSE",
+  [OP_JUMP_IF_TRUE] = "OP_JUMP_IF_TRUE",
+  [OP_POP_JUMP_IF_FALSE] = "OP_POP_JUMP_IF_FALSE",
+  [OP_POP_JUMP_IF_TRUE] = "OP_POP_JUMP_IF_TRUE",
+  [OP_LESS_JUMP_FALSE] = "OP_LESS_JUMP_FALSE",
+  [OP_LESS_JUMP_TRUE] = "OP_LESS_JUMP_TRUE",
+  [OP_GREATER_JUMP_FALSE] = "OP_GREATER_JUMP_FALSE",
+  [OP_GREATER_JUMP_TRUE] = "OP_GREATER_JUMP_TRUE",
+  [OP_EQUAL_JUMP_FALSE] = "OP_EQUAL_JUMP_FALSE",
+  [OP_EQUAL_JUMP_TRUE] = "OP_EQUAL_JUMP_TRUE",
+  [OP_LOOP] = "OP_LOOP",
+  [OP_CALL] = "OP_CALL",
+  [OP_TAIL_CALL] = "OP_TAIL_CALL",
+  [OP_INVOKE] = "OP_INVOKE",
+  [OP_SUPER_INVOKE] = "OP_SUPER_INVOKE",
+  [OP_CLOSURE] = "OP_CLOSURE",
+  [OP_CLOSE_UPVALUE] = "OP_CLOSE_UPVALUE",
+  [OP_RETURN] = "OP_RETURN",
+  [OP_CLASS] = "OP_CLASS",
+  [OP_INHERIT] = "OP_INHERIT",
+  [OP_METHOD] = "OP_METHOD",
+  [OP_ARRAY] = "OP_ARRAY",
+  [OP_OBJECT_GET] = "OP_OBJECT_GET",
+  [OP_OBJECT_SET] = "OP_OBJECT_SET",
+  [OP_BITWISE_AND] = "OP_BITWISE_AND",
+  [OP_BITWISE_OR] = "OP_BITWISE_OR",
+  [OP_BITWISE_XOR] = "OP_BITWISE_XOR",
+  [OP_BITWISE_LS] = "OP_BITWISE_LS",
+  [OP_BITWISE_RS] = "OP_BITWISE_RS",
+  [OP_BITWISE_NOT] = "OP_BITWISE_NOT",
+  [OP_DICT] = "OP_DICT",
+};
+
+void profileTakeSample() {
+  profileSampleCountdown = PROFILE_SAMPLE_INTERVAL;
+
+  char stack[2048];
+  size_t length = 0;
+  for (int i = 0; i < vm.frameCount; i++) {
+    CallFrame* frame = &vm.frames[i];
+    ObjFunction* function = frame->closure->function;
+    const char* name =
+        function->name != NULL ? function->name->chars : "script";
+    int offset = (int)(frame->ip - function->chunk.code);
+    // parent frames store the return address, one past the call site
+    if (i < vm.frameCount - 1 && offset > 0) offset--;
+    int line = getLine(&function->chunk, offset);
+    int written = snprintf(stack + length, sizeof(stack) - length, "%s%s:%d",
+                          i == 0 ? "" : ";", name, line);
+    if (written < 0 || length + written >= sizeof(stack)) break;
+    length += written;
+  }
+  if (length == 0) return;
+
+  if (sampleCount == sampleCapacity) {
+    sampleCapacity = sampleCapacity < 64 ? 64 : sampleCapacity * 2;
+    samples = (char**)realloc(samples, sizeof(char*) * sampleCapacity);
+    if (samples == NULL) exit(1);
+  }
+  samples[sampleCount++] = strdup(stack);
+}
+
+static int compareSamples(const void* a, const void* b) {
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static int compareOpcodeCounts(const void* a, const void* b) {
+  uint64_t countA = profileOpcodeCounts[*(const uint8_t*)a];
+  uint64_t countB = profileOpcodeCounts[*(const uint8_t*)b];
+  return (countA < countB) - (countA > countB);
+}
+
+void profileDump() {
+  // flamegraph-compatible collapsed stacks: "frame;frame;frame count"
+  FILE* folded = fopen("embr-profile.folded", "w");
+  if (folded != NULL) {
+    if (sampleCount > 0) {
+      qsort(samples, sampleCount, sizeof(char*), compareSamples);
+    }
+    for (int i = 0; i < sampleCount;) {
+      int run = 1;
+      while (i + run < sampleCount &&
+            strcmp(samples[i], samples[i + run]) == 0) {
+        run++;
+      }
+      fprintf(folded, "%s %d\n", samples[i], run);
+      i += run;
+    }
+    fclose(folded);
+  }
+
+  uint8_t order[UINT8_COUNT];
+  for (int i = 0; i < UINT8_COUNT; i++) order[i] = (uint8_t)i;
+  qsort(order, UINT8_COUNT, sizeof(uint8_t), compareOpcodeCounts);
+
+  uint64_t total = 0;
+  for (int i = 0; i < UINT8_COUNT; i++) total += profileOpcodeCounts[i];
+
+  fprintf(stderr, "== profile: %llu instructions, %d stack samples ==\n",
+          (unsigned long long)total, sampleCount);
+  for (int i = 0; i < UINT8_COUNT; i++) {
+    uint64_t count = profileOpcodeCounts[order[i]];
+    if (count == 0) break;
+    const char* name = opcodeNames[order[i]];
+    fprintf(stderr, "%-24s %12llu (%5.2f%%)\n",
+            name != NULL ? name : "unknown", (unsigned long long)count,
+            100.0 * (double)count / (double)total);
+  }
+
+  for (int i = 0; i < sampleCount; i++) free(samples[i]);
+  free(samples);
+  samples = NULL;
+  sampleCount = 0;
+  sampleCapacity = 0;
+}
+
+#endif
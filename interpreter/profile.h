@@ -0,0 +1,21 @@
+#ifndef embr_profile_h
+#define embr_profile_h
+
+#include "common.h"
+
+#ifdef DEBUG_PROFILE
+
+// deterministic sampling: every PROFILE_SAMPLE_INTERVAL dispatched
+// instructions the run loop spills its registers and records the CallFrame
+// stack, so no signals and no async-safety worries
+#define PROFILE_SAMPLE_INTERVAL 4096
+
+extern uint64_t profileOpcodeCounts[];
+extern int profileSampleCountdown;
+
+void profileTakeSample();
+void profileDump();
+
+#endif
+
+#endif
@@ -0,0 +1,881 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "serialize.h"
+#include "vm.h"
+
+#define BYTECODE_MAGIC   0x43424d45u // "EMBC"
+#define BYTECODE_VERSION 6 // v6: line tables store only live runs
+
+// constant pool tags
+enum {
+  CONST_NIL,
+  CONST_FALSE,
+  CONST_TRUE,
+  CONST_NUMBER,
+  CONST_STRING,
+  CONST_FUNCTION,
+};
+
+static void writeU8(FILE* out, uint8_t value) {
+  fwrite(&value, sizeof(uint8_t), 1, out);
+}
+
+static void writeI32(FILE* out, int32_t value) {
+  fwrite(&value, sizeof(int32_t), 1, out);
+}
+
+static void writeU64(FILE* out, uint64_t value) {
+  fwrite(&value, sizeof(uint64_t), 1, out);
+}
+
+// pads to an 8-byte boundary so the loader can point at in-file structs
+static void writePadding(FILE* out) {
+  static const uint8_t zeros[8] = {0};
+  long position = ftell(out);
+  if (position % 8 != 0) {
+    fwrite(zeros, 1, 8 - (size_t)(position % 8), out);
+  }
+}
+
+static void writeString(FILE* out, ObjString* string) {
+  if (string == NULL) {
+    writeI32(out, -1);
+    return;
+  }
+  writeI32(out, string->length);
+  fwrite(string->chars, 1, string->length, out);
+}
+
+static void writeFunction(FILE* out, ObjFunction* function) {
+  writeI32(out, function->arity);
+  writeI32(out, function->upvalueCount);
+  writeI32(out, (int32_t)function->returnType);
+  writeString(out, function->name);
+
+  Chunk* chunk = &function->chunk;
+  writeI32(out, chunk->cacheCount);
+  writeI32(out, chunk->count);
+  fwrite(chunk->code, 1, chunk->count, out);
+  writePadding(out);
+  writeI32(out, chunk->lineRunCount);
+  fwrite(chunk->lines, sizeof(LineRun), chunk->lineRunCount, out);
+
+  writeI32(out, chunk->constants.count);
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (IS_NIL(constant)) {
+      writeU8(out, CONST_NIL);
+    } else if (IS_BOOL(constant)) {
+      writeU8(out, AS_BOOL(constant) ? CONST_TRUE : CONST_FALSE);
+    } else if (IS_NUMBER(constant)) {
+      writeU8(out, CONST_NUMBER);
+      double number = AS_NUMBER(constant);
+      fwrite(&number, sizeof(double), 1, out);
+    } else if (IS_STRING(constant)) {
+      writeU8(out, CONST_STRING);
+      writeString(out, AS_STRING(constant));
+    } else {
+      writeU8(out, CONST_FUNCTION);
+      writeFunction(out, AS_FUNCTION(constant));
+    }
+  }
+}
+
+bool writeBytecodeFile(const char* path, uint64_t sourceMtime,
+                      ObjFunction* function) {
+  FILE* out = fopen(path, "wb");
+  if (out == NULL) return false;
+
+  writeI32(out, (int32_t)BYTECODE_MAGIC);
+  writeI32(out, BYTECODE_VERSION);
+  writeU64(out, sourceMtime);
+
+  // global slot table in slot order: the loader recreates it before anything
+  // else so the slot indices baked into the code stay valid
+  writeI32(out, vm.globalNames.count);
+  for (int i = 0; i < vm.globalNames.count; i++) {
+    writeString(out, AS_STRING(vm.globalNames.values[i]));
+  }
+
+  writeI32(out, compiledImportCount());
+  for (int i = 0; i < compiledImportCount(); i++) {
+    const char* name = compiledImportName(i);
+    writeI32(out, (int32_t)strlen(name));
+    fwrite(name, 1, strlen(name), out);
+  }
+
+  writeFunction(out, function);
+
+  bool ok = ferror(out) == 0;
+  fclose(out);
+  if (!ok) remove(path);
+  return ok;
+}
+
+typedef struct {
+  const uint8_t* data;
+  size_t size;
+  size_t offset;
+  bool failed;
+} Reader;
+
+static const uint8_t* readBytes(Reader* reader, size_t count) {
+  if (reader->failed || count > reader->size - reader->offset) {
+    reader->failed = true;
+    return NULL;
+  }
+  const uint8_t* bytes = reader->data + reader->offset;
+  reader->offset += count;
+  return bytes;
+}
+
+static int32_t readI32(Reader* reader) {
+  const uint8_t* bytes = readBytes(reader, sizeof(int32_t));
+  if (bytes == NULL) return 0;
+  int32_t value;
+  memcpy(&value, bytes, sizeof(int32_t));
+  return value;
+}
+
+static uint64_t readU64(Reader* reader) {
+  const uint8_t* bytes = readBytes(reader, sizeof(uint64_t));
+  if (bytes == NULL) return 0;
+  uint64_t value;
+  memcpy(&value, bytes, sizeof(uint64_t));
+  return value;
+}
+
+static void alignReader(Reader* reader) {
+  reader->offset = (reader->offset + 7) & ~(size_t)7;
+}
+
+static ObjString* readString(Reader* reader) {
+  int32_t length = readI32(reader);
+  if (length < 0 || reader->failed) return NULL;
+  const uint8_t* bytes = readBytes(reader, (size_t)length);
+  if (bytes == NULL) return NULL;
+  return copyString((const char*)bytes, length);
+}
+
+static ObjFunction* readFunction(Reader* reader) {
+  ObjFunction* function = newFunction();
+  push(OBJ_VAL(function)); // keep it rooted while the constants load
+
+  function->arity = readI32(reader);
+  function->upvalueCount = readI32(reader);
+  function->returnType = (FunctionReturnType)readI32(reader);
+  function->name = readString(reader);
+
+  Chunk* chunk = &function->chunk;
+  int32_t cacheCount = readI32(reader);
+  for (int32_t i = 0; i < cacheCount && !reader->failed; i++) {
+    addInlineCache(chunk);
+  }
+
+  int32_t codeCount = readI32(reader);
+  const uint8_t* code = readBytes(reader, (size_t)codeCount);
+  alignReader(reader);
+  int32_t lineRunCount = readI32(reader);
+  const uint8_t* lines =
+      readBytes(reader, (size_t)lineRunCount * sizeof(LineRun));
+  if (code != NULL && lines != NULL) {
+    // the chunk executes straight out of the mapping; freeChunk leaves
+    // mapped arrays alone
+    chunk->count = codeCount;
+    chunk->capacity = codeCount;
+    chunk->code = (uint8_t*)code;
+    chunk->lines = (LineRun*)lines;
+    chunk->lineRunCount = lineRunCount;
+    chunk->mapped = true;
+  }
+
+  int32_t constantCount = readI32(reader);
+  for (int32_t i = 0; i < constantCount && !reader->failed; i++) {
+    const uint8_t* tag = readBytes(reader, 1);
+    if (tag == NULL) break;
+    switch (*tag) {
+      case CONST_NIL: addConstant(chunk, NIL_VAL); break;
+      case CONST_FALSE: addConstant(chunk, BOOL_VAL(false)); break;
+      case CONST_TRUE: addConstant(chunk, BOOL_VAL(true)); break;
+      case CONST_NUMBER: {
+        const uint8_t* bytes = readBytes(reader, sizeof(double));
+        if (bytes == NULL) break;
+        double number;
+        memcpy(&number, bytes, sizeof(double));
+        addConstant(chunk, NUMBER_VAL(number));
+        break;
+      }
+      case CONST_STRING: {
+        ObjString* string = readString(reader);
+        if (string == NULL) {
+          reader->failed = true;
+          break;
+        }
+        addConstant(chunk, OBJ_VAL(string));
+        break;
+      }
+      case CONST_FUNCTION: {
+        ObjFunction* child = readFunction(reader);
+        if (child == NULL) break;
+        addConstant(chunk, OBJ_VAL(child));
+        break;
+      }
+      default:
+        reader->failed = true;
+        break;
+    }
+  }
+
+  pop();
+  return reader->failed ? NULL : function;
+}
+
+ObjFunction* loadBytecodeFile(const char* path, uint64_t sourceMtime) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size < 16) {
+    close(fd);
+    return NULL;
+  }
+
+  size_t size = (size_t)fileStat.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return NULL;
+
+  Reader reader;
+  reader.data = (const uint8_t*)map;
+  reader.size = size;
+  reader.offset = 0;
+  reader.failed = false;
+
+  if ((uint32_t)readI32(&reader) != BYTECODE_MAGIC ||
+      readI32(&reader) != BYTECODE_VERSION) {
+    munmap(map, size);
+    return NULL;
+  }
+
+  uint64_t mtime = readU64(&reader);
+  if (sourceMtime != 0 && mtime != sourceMtime) {
+    munmap(map, size);
+    return NULL;
+  }
+
+  int32_t globalCount = readI32(&reader);
+  for (int32_t i = 0; i < globalCount && !reader.failed; i++) {
+    ObjString* name = readString(&reader);
+    // natives registered by initVM claim the low slots in both processes; if
+    // the replayed table doesn't line up (say the native set changed), the
+    // baked-in slot operands are meaningless and the file is stale
+    if (name == NULL || globalSlot(name) != i) {
+      munmap(map, size);
+      return NULL;
+    }
+  }
+
+  int32_t importCount = readI32(&reader);
+  for (int32_t i = 0; i < importCount && !reader.failed; i++) {
+    int32_t length = readI32(&reader);
+    const uint8_t* bytes = readBytes(&reader, (size_t)length);
+    if (bytes == NULL) break;
+    char* name = (char*)malloc((size_t)length + 1);
+    if (name == NULL) break;
+    memcpy(name, bytes, (size_t)length);
+    name[length] = '\0';
+    loadFile(name);
+    free(name);
+  }
+
+  // the mapping is never unmapped: loaded chunks execute out of it for the
+  // rest of the process
+  return readFunction(&reader);
+}
+
+// ---- heap images ----
+
+#define SNAPSHOT_MAGIC   0x49424d45u // "EMBI"
+#define SNAPSHOT_VERSION 7 // v7: line tables store only live runs
+
+// value record tags; SNAP_OBJ introduces an object (assigned the next id in
+// stream order), SNAP_REF points back at one already introduced
+enum {
+  SNAP_NIL,
+  SNAP_FALSE,
+  SNAP_TRUE,
+  SNAP_UNDEFINED,
+  SNAP_NUMBER,
+  SNAP_REF,
+  SNAP_OBJ,
+};
+
+// pointer -> id map so every object is written once and shared structure
+// (and cycles) survive the round trip
+typedef struct {
+  Obj* object;
+  uint32_t id;
+} SnapEntry;
+
+typedef struct {
+  SnapEntry* entries;
+  int capacity;
+  int count;
+  bool failed;
+} SnapMap;
+
+static uint32_t snapHash(Obj* object) {
+  return (uint32_t)(((uintptr_t)object) >> 4) * 2654435761u;
+}
+
+static int snapMapFind(SnapMap* map, Obj* object) {
+  if (map->capacity == 0) return -1;
+  uint32_t index = snapHash(object) & (uint32_t)(map->capacity - 1);
+  for (;;) {
+    SnapEntry* entry = &map->entries[index];
+    if (entry->object == NULL) return -1;
+    if (entry->object == object) return (int)entry->id;
+    index = (index + 1) & (uint32_t)(map->capacity - 1);
+  }
+}
+
+static void snapMapPut(SnapMap* map, Obj* object, uint32_t id) {
+  if (map->count + 1 > map->capacity * 3 / 4) {
+    int oldCapacity = map->capacity;
+    SnapEntry* oldEntries = map->entries;
+    map->capacity = oldCapacity < 64 ? 64 : oldCapacity * 2;
+    map->entries = (SnapEntry*)calloc((size_t)map->capacity,
+                                      sizeof(SnapEntry));
+    if (map->entries == NULL) exit(1);
+    for (int i = 0; i < oldCapacity; i++) {
+      if (oldEntries[i].object == NULL) continue;
+      uint32_t index =
+          snapHash(oldEntries[i].object) & (uint32_t)(map->capacity - 1);
+      while (map->entries[index].object != NULL) {
+        index = (index + 1) & (uint32_t)(map->capacity - 1);
+      }
+      map->entries[index] = oldEntries[i];
+    }
+    free(oldEntries);
+  }
+
+  uint32_t index = snapHash(object) & (uint32_t)(map->capacity - 1);
+  while (map->entries[index].object != NULL) {
+    index = (index + 1) & (uint32_t)(map->capacity - 1);
+  }
+  map->entries[index].object = object;
+  map->entries[index].id = id;
+  map->count++;
+}
+
+// natives carry no name of their own, so they serialize as the name of the
+// global slot that registered them and resolve against the loading process
+static ObjString* nativeName(Obj* native) {
+  for (int i = 0; i < vm.globalValues.count; i++) {
+    Value value = vm.globalValues.values[i];
+    if (IS_OBJ(value) && AS_OBJ(value) == native) {
+      return AS_STRING(vm.globalNames.values[i]);
+    }
+  }
+  return NULL;
+}
+
+static void writeSnapshotValue(FILE* out, SnapMap* map, Value value);
+
+static void writeSnapshotObject(FILE* out, SnapMap* map, Obj* object) {
+  int existing = snapMapFind(map, object);
+  if (existing >= 0) {
+    writeU8(out, SNAP_REF);
+    writeI32(out, existing);
+    return;
+  }
+
+  uint32_t id = (uint32_t)map->count;
+  snapMapPut(map, object, id);
+  writeU8(out, SNAP_OBJ);
+  writeU8(out, (uint8_t)object->type);
+
+  switch (object->type) {
+    case OBJ_STRING:
+      writeString(out, (ObjString*)object);
+      break;
+    case OBJ_FUNCTION: {
+      ObjFunction* function = (ObjFunction*)object;
+      writeI32(out, function->arity);
+      writeI32(out, function->upvalueCount);
+      writeI32(out, (int32_t)function->returnType);
+      writeString(out, function->name);
+      Chunk* chunk = &function->chunk;
+      writeI32(out, chunk->cacheCount);
+      writeI32(out, chunk->count);
+      fwrite(chunk->code, 1, chunk->count, out);
+      writePadding(out);
+      writeI32(out, chunk->lineRunCount);
+      fwrite(chunk->lines, sizeof(LineRun), chunk->lineRunCount, out);
+      writeI32(out, chunk->constants.count);
+      for (int i = 0; i < chunk->constants.count; i++) {
+        writeSnapshotValue(out, map, chunk->constants.values[i]);
+      }
+      break;
+    }
+    case OBJ_CLOSURE: {
+      ObjClosure* closure = (ObjClosure*)object;
+      writeSnapshotObject(out, map, (Obj*)closure->function);
+      writeI32(out, closure->upvalueCount);
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        writeSnapshotObject(out, map, (Obj*)closure->upvalues[i]);
+      }
+      break;
+    }
+    case OBJ_UPVALUE: {
+      // snapshots are taken between scripts, when every upvalue is closed
+      ObjUpvalue* upvalue = (ObjUpvalue*)object;
+      writeSnapshotValue(out, map, *upvalue->location);
+      break;
+    }
+    case OBJ_CLASS: {
+      ObjClass* klass = (ObjClass*)object;
+      writeSnapshotObject(out, map, (Obj*)klass->name);
+      writeI32(out, klass->methods.count);
+      for (int i = 0; i < klass->methods.capacity; i++) {
+        Entry* entry = &klass->methods.entries[i];
+        if (entry->key == NULL) continue;
+        writeSnapshotObject(out, map, (Obj*)entry->key);
+        writeSnapshotValue(out, map, entry->value);
+      }
+      break;
+    }
+    case OBJ_INSTANCE: {
+      ObjInstance* instance = (ObjInstance*)object;
+      writeSnapshotObject(out, map, (Obj*)instance->klass);
+      int fieldCount = instance->shape->fieldCount;
+      writeI32(out, fieldCount);
+      ObjString** names =
+          (ObjString**)calloc((size_t)fieldCount, sizeof(ObjString*));
+      if (names == NULL) exit(1);
+      for (int i = 0; i < instance->shape->slots.capacity; i++) {
+        Entry* entry = &instance->shape->slots.entries[i];
+        if (entry->key == NULL) continue;
+        names[(int)AS_NUMBER(entry->value)] = entry->key;
+      }
+      for (int i = 0; i < fieldCount; i++) {
+        writeSnapshotObject(out, map, (Obj*)names[i]);
+        writeSnapshotValue(out, map, instance->fields[i]);
+      }
+      free(names);
+      break;
+    }
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod* bound = (ObjBoundMethod*)object;
+      writeSnapshotValue(out, map, bound->receiver);
+      writeSnapshotObject(out, map, (Obj*)bound->method);
+      break;
+    }
+    case OBJ_ARRAY: {
+      ObjArray* array = (ObjArray*)object;
+      writeI32(out, array->count);
+      for (int i = 0; i < array->count; i++) {
+        writeSnapshotValue(out, map, array->values[i]);
+      }
+      break;
+    }
+    case OBJ_DICT: {
+      ObjDict* dict = (ObjDict*)object;
+      // count live pairs; items.count still includes tombstones
+      int32_t pairs = 0;
+      for (int i = 0; i < dict->items.capacity; i++) {
+        if (!IS_UNDEFINED(dict->items.entries[i].key)) pairs++;
+      }
+      writeI32(out, pairs);
+      for (int i = 0; i < dict->items.capacity; i++) {
+        ValueEntry* entry = &dict->items.entries[i];
+        if (IS_UNDEFINED(entry->key)) continue;
+        writeSnapshotValue(out, map, entry->key);
+        writeSnapshotValue(out, map, entry->value);
+      }
+      break;
+    }
+    case OBJ_FLOAT_ARRAY: {
+      ObjFloatArray* array = (ObjFloatArray*)object;
+      writeI32(out, array->count);
+      fwrite(array->values, sizeof(double), array->count, out);
+      break;
+    }
+    case OBJ_NATIVE: {
+      ObjString* name = nativeName(object);
+      if (name == NULL) {
+        map->failed = true;
+        writeI32(out, -1);
+      } else {
+        writeString(out, name);
+      }
+      break;
+    }
+  }
+}
+
+static void writeSnapshotValue(FILE* out, SnapMap* map, Value value) {
+  if (IS_NIL(value)) {
+    writeU8(out, SNAP_NIL);
+  } else if (IS_UNDEFINED(value)) {
+    writeU8(out, SNAP_UNDEFINED);
+  } else if (IS_BOOL(value)) {
+    writeU8(out, AS_BOOL(value) ? SNAP_TRUE : SNAP_FALSE);
+  } else if (IS_NUMBER(value)) {
+    writeU8(out, SNAP_NUMBER);
+    double number = AS_NUMBER(value);
+    fwrite(&number, sizeof(double), 1, out);
+  } else {
+    writeSnapshotObject(out, map, AS_OBJ(value));
+  }
+}
+
+bool writeSnapshotFile(const char* path) {
+  FILE* out = fopen(path, "wb");
+  if (out == NULL) return false;
+
+  writeI32(out, (int32_t)SNAPSHOT_MAGIC);
+  writeI32(out, SNAPSHOT_VERSION);
+
+  writeI32(out, vm.globalNames.count);
+  for (int i = 0; i < vm.globalNames.count; i++) {
+    writeString(out, AS_STRING(vm.globalNames.values[i]));
+  }
+
+  SnapMap map;
+  map.entries = NULL;
+  map.capacity = 0;
+  map.count = 0;
+  map.failed = false;
+  for (int i = 0; i < vm.globalValues.count; i++) {
+    writeSnapshotValue(out, &map, vm.globalValues.values[i]);
+  }
+  free(map.entries);
+
+  bool ok = !map.failed && ferror(out) == 0;
+  fclose(out);
+  if (!ok) remove(path);
+  return ok;
+}
+
+// id -> rebuilt object; every entry is also pushed on the VM stack while the
+// load runs so a collection can't sweep the half-built graph
+typedef struct {
+  Obj** objects;
+  int capacity;
+  uint32_t nextId;
+  int pushed;
+} SnapRegistry;
+
+static void registerSnapObject(SnapRegistry* registry, uint32_t id,
+                              Obj* object) {
+  if ((int)id >= registry->capacity) {
+    int oldCapacity = registry->capacity;
+    registry->capacity = oldCapacity < 256 ? 256 : oldCapacity * 2;
+    registry->objects = (Obj**)realloc(
+        registry->objects, sizeof(Obj*) * (size_t)registry->capacity);
+    if (registry->objects == NULL) exit(1);
+    for (int i = oldCapacity; i < registry->capacity; i++) {
+      registry->objects[i] = NULL;
+    }
+  }
+  registry->objects[id] = object;
+  push(OBJ_VAL(object));
+  registry->pushed++;
+}
+
+static Value readSnapshotValue(Reader* reader, SnapRegistry* registry);
+
+static Obj* readSnapshotObject(Reader* reader, SnapRegistry* registry,
+                              uint8_t tag) {
+  if (tag == SNAP_REF) {
+    int32_t id = readI32(reader);
+    if (id < 0 || (uint32_t)id >= registry->nextId ||
+        registry->objects[id] == NULL) {
+      reader->failed = true;
+      return NULL;
+    }
+    return registry->objects[id];
+  }
+
+  if (tag != SNAP_OBJ) {
+    reader->failed = true;
+    return NULL;
+  }
+
+  uint32_t id = registry->nextId++;
+  const uint8_t* typeByte = readBytes(reader, 1);
+  if (typeByte == NULL) return NULL;
+
+  switch ((ObjType)*typeByte) {
+    case OBJ_STRING: {
+      ObjString* string = readString(reader);
+      if (string == NULL) {
+        reader->failed = true;
+        return NULL;
+      }
+      registerSnapObject(registry, id, (Obj*)string);
+      return (Obj*)string;
+    }
+    case OBJ_FUNCTION: {
+      ObjFunction* function = newFunction();
+      registerSnapObject(registry, id, (Obj*)function);
+      function->arity = readI32(reader);
+      function->upvalueCount = readI32(reader);
+      function->returnType = (FunctionReturnType)readI32(reader);
+      function->name = readString(reader);
+      Chunk* chunk = &function->chunk;
+      int32_t cacheCount = readI32(reader);
+      for (int32_t i = 0; i < cacheCount && !reader->failed; i++) {
+        addInlineCache(chunk);
+      }
+      int32_t codeCount = readI32(reader);
+      const uint8_t* code = readBytes(reader, (size_t)codeCount);
+      alignReader(reader);
+      int32_t lineRunCount = readI32(reader);
+      const uint8_t* lines =
+          readBytes(reader, (size_t)lineRunCount * sizeof(LineRun));
+      if (code != NULL && lines != NULL) {
+        chunk->count = codeCount;
+        chunk->capacity = codeCount;
+        chunk->code = (uint8_t*)code;
+        chunk->lines = (LineRun*)lines;
+        chunk->lineRunCount = lineRunCount;
+        chunk->mapped = true;
+      }
+      int32_t constantCount = readI32(reader);
+      for (int32_t i = 0; i < constantCount && !reader->failed; i++) {
+        addConstant(chunk, readSnapshotValue(reader, registry));
+      }
+      return (Obj*)function;
+    }
+    case OBJ_CLOSURE: {
+      // a function subtree can only reach strings and other functions, so it
+      // is safe to load before the closure shell exists; cycles back into the
+      // closure can only occur through the upvalues read afterwards
+      Value functionValue = readSnapshotValue(reader, registry);
+      if (reader->failed || !IS_FUNCTION(functionValue)) {
+        reader->failed = true;
+        return NULL;
+      }
+      ObjClosure* closure = newClosure(AS_FUNCTION(functionValue));
+      registerSnapObject(registry, id, (Obj*)closure);
+      int32_t upvalueCount = readI32(reader);
+      if (upvalueCount != closure->upvalueCount) {
+        reader->failed = true;
+        return NULL;
+      }
+      for (int32_t i = 0; i < upvalueCount && !reader->failed; i++) {
+        Value upvalue = readSnapshotValue(reader, registry);
+        if (reader->failed || !IS_OBJ(upvalue) ||
+            AS_OBJ(upvalue)->type != OBJ_UPVALUE) {
+          reader->failed = true;
+          return NULL;
+        }
+        closure->upvalues[i] = (ObjUpvalue*)AS_OBJ(upvalue);
+      }
+      return (Obj*)closure;
+    }
+    case OBJ_UPVALUE: {
+      ObjUpvalue* upvalue = newUpvalue(NULL);
+      upvalue->location = &upvalue->closed;
+      registerSnapObject(registry, id, (Obj*)upvalue);
+      upvalue->closed = readSnapshotValue(reader, registry);
+      return (Obj*)upvalue;
+    }
+    case OBJ_CLASS: {
+      Value nameValue = readSnapshotValue(reader, registry);
+      if (reader->failed || !IS_STRING(nameValue)) {
+        reader->failed = true;
+        return NULL;
+      }
+      ObjClass* klass = newClass(AS_STRING(nameValue));
+      registerSnapObject(registry, id, (Obj*)klass);
+      int32_t methodCount = readI32(reader);
+      for (int32_t i = 0; i < methodCount && !reader->failed; i++) {
+        Value key = readSnapshotValue(reader, registry);
+        Value method = readSnapshotValue(reader, registry);
+        if (reader->failed || !IS_STRING(key)) {
+          reader->failed = true;
+          return NULL;
+        }
+        tableSet(&klass->methods, AS_STRING(key), method);
+      }
+      return (Obj*)klass;
+    }
+    case OBJ_INSTANCE: {
+      // the class subtree can cycle back here through method upvalues, so
+      // the shell registers before its class loads
+      ObjInstance* instance = newInstance(NULL);
+      registerSnapObject(registry, id, (Obj*)instance);
+      Value klassValue = readSnapshotValue(reader, registry);
+      if (reader->failed || !IS_CLASS(klassValue)) {
+        reader->failed = true;
+        return NULL;
+      }
+      instance->klass = AS_CLASS(klassValue);
+      int32_t fieldCount = readI32(reader);
+      for (int32_t i = 0; i < fieldCount && !reader->failed; i++) {
+        Value name = readSnapshotValue(reader, registry);
+        Value field = readSnapshotValue(reader, registry);
+        if (reader->failed || !IS_STRING(name)) {
+          reader->failed = true;
+          return NULL;
+        }
+        instanceSetField(instance, AS_STRING(name), field);
+      }
+      return (Obj*)instance;
+    }
+    case OBJ_BOUND_METHOD: {
+      ObjBoundMethod* bound = newBoundMethod(NIL_VAL, NULL);
+      registerSnapObject(registry, id, (Obj*)bound);
+      bound->receiver = readSnapshotValue(reader, registry);
+      Value method = readSnapshotValue(reader, registry);
+      if (reader->failed || !IS_CLOSURE(method)) {
+        reader->failed = true;
+        return NULL;
+      }
+      bound->method = AS_CLOSURE(method);
+      return (Obj*)bound;
+    }
+    case OBJ_ARRAY: {
+      ObjArray* array = newArray();
+      registerSnapObject(registry, id, (Obj*)array);
+      int32_t count = readI32(reader);
+      for (int32_t i = 0; i < count && !reader->failed; i++) {
+        writeArray(array, readSnapshotValue(reader, registry));
+      }
+      return (Obj*)array;
+    }
+    case OBJ_DICT: {
+      ObjDict* dict = newDict();
+      registerSnapObject(registry, id, (Obj*)dict);
+      int32_t count = readI32(reader);
+      for (int32_t i = 0; i < count && !reader->failed; i++) {
+        Value key = readSnapshotValue(reader, registry);
+        Value item = readSnapshotValue(reader, registry);
+        if (reader->failed) return NULL;
+        writeDict(dict, key, item);
+      }
+      return (Obj*)dict;
+    }
+    case OBJ_FLOAT_ARRAY: {
+      int32_t count = readI32(reader);
+      if (reader->failed || count < 0) {
+        reader->failed = true;
+        return NULL;
+      }
+      ObjFloatArray* array = newFloatArray(count);
+      registerSnapObject(registry, id, (Obj*)array);
+      const uint8_t* bytes = readBytes(reader, (size_t)count * sizeof(double));
+      if (bytes == NULL) return NULL;
+      memcpy(array->values, bytes, (size_t)count * sizeof(double));
+      return (Obj*)array;
+    }
+    case OBJ_NATIVE: {
+      ObjString* name = readString(reader);
+      Value slot;
+      if (name == NULL || !tableGet(&vm.globals, name, &slot)) {
+        reader->failed = true;
+        return NULL;
+      }
+      Value native = vm.globalValues.values[(int)AS_NUMBER(slot)];
+      if (!IS_NATIVE(native)) {
+        reader->failed = true;
+        return NULL;
+      }
+      registerSnapObject(registry, id, AS_OBJ(native));
+      return AS_OBJ(native);
+    }
+  }
+
+  reader->failed = true;
+  return NULL;
+}
+
+static Value readSnapshotValue(Reader* reader, SnapRegistry* registry) {
+  const uint8_t* tag = readBytes(reader, 1);
+  if (tag == NULL) return NIL_VAL;
+  switch (*tag) {
+    case SNAP_NIL: return NIL_VAL;
+    case SNAP_FALSE: return BOOL_VAL(false);
+    case SNAP_TRUE: return BOOL_VAL(true);
+    case SNAP_UNDEFINED: return UNDEFINED_VAL;
+    case SNAP_NUMBER: {
+      const uint8_t* bytes = readBytes(reader, sizeof(double));
+      if (bytes == NULL) return NIL_VAL;
+      double number;
+      memcpy(&number, bytes, sizeof(double));
+      return NUMBER_VAL(number);
+    }
+    default: {
+      Obj* object = readSnapshotObject(reader, registry, *tag);
+      if (object == NULL) return NIL_VAL;
+      return OBJ_VAL(object);
+    }
+  }
+}
+
+bool loadSnapshotFile(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat fileStat;
+  if (fstat(fd, &fileStat) != 0 || fileStat.st_size < 12) {
+    close(fd);
+    return false;
+  }
+
+  size_t size = (size_t)fileStat.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return false;
+
+  Reader reader;
+  reader.data = (const uint8_t*)map;
+  reader.size = size;
+  reader.offset = 0;
+  reader.failed = false;
+
+  if ((uint32_t)readI32(&reader) != SNAPSHOT_MAGIC ||
+      readI32(&reader) != SNAPSHOT_VERSION) {
+    munmap(map, size);
+    return false;
+  }
+
+  // the slot table replays exactly like a .mbc load: the slot operands baked
+  // into snapshotted code must mean the same thing here
+  int32_t globalCount = readI32(&reader);
+  for (int32_t i = 0; i < globalCount && !reader.failed; i++) {
+    ObjString* name = readString(&reader);
+    if (name == NULL || globalSlot(name) != i) {
+      munmap(map, size);
+      return false;
+    }
+  }
+
+  SnapRegistry registry;
+  registry.objects = NULL;
+  registry.capacity = 0;
+  registry.nextId = 0;
+  registry.pushed = 0;
+
+  for (int32_t i = 0; i < globalCount && !reader.failed; i++) {
+    Value value = readSnapshotValue(&reader, &registry);
+    if (!reader.failed) vm.globalValues.values[i] = value;
+  }
+
+  for (int i = 0; i < registry.pushed; i++) pop();
+  free(registry.objects);
+
+  // like .mbc, the mapping stays: restored functions execute out of it
+  return !reader.failed;
+}
@@ -0,0 +1,29 @@
+#ifndef embr_serialize_h
+#define embr_serialize_h
+
+#include "object.h"
+
+// Compiled bytecode container (.mbc). The writer dumps a script's top-level
+// ObjFunction -- code, line runs, constant pool, nested functions -- plus the
+// names of its direct imports so a cached run can replay them. The loader
+// memory-maps the file and points chunks straight at the mapping, so code
+// bytes execute without being copied. Files are a per-machine cache, not a
+// portable distribution format.
+// sourceMtime is the modification time of the source the bytecode came from;
+// the loader rejects a file whose recorded mtime differs (pass 0 to skip the
+// check when running a .mbc directly).
+bool writeBytecodeFile(const char* path, uint64_t sourceMtime,
+                      ObjFunction* function);
+ObjFunction* loadBytecodeFile(const char* path, uint64_t sourceMtime);
+
+// VM heap images (.mbi). The writer walks everything reachable from the
+// global table -- closures, classes, instances, the lot -- and serializes the
+// graph with identity preserved; the loader rebuilds it into a freshly
+// initialized VM so a new process skips warmup. Values embed raw object
+// addresses under NaN boxing, so the image is rebuilt on load rather than
+// mapped in place; function code bytes still execute straight from the
+// mapping like .mbc files.
+bool writeSnapshotFile(const char* path);
+bool loadSnapshotFile(const char* path);
+
+#endif
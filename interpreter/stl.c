@@ -0,0 +1,50 @@
+#include <string.h>
+
+#include "stl.h"
+
+// The stl/*.mbr sources, baked in at build time so imports of standard
+// modules never stat or read the filesystem (and work no matter what the
+// current directory is). Keep these in sync with the files under stl/.
+
+static const char mathSource[] =
+  "class Math {\n"
+  "  power(base, exponent) {\n"
+  "    var result = 1;\n"
+  "    for (var i = 0; i < exponent; i = i + 1) {\n"
+  "      result = result * base;\n"
+  "    }\n"
+  "    return result;\n"
+  "  }\n"
+  "\n"
+  "  sqrt(x) {\n"
+  "    if (x < 0) {\n"
+  "      return \"Error: Negative argument for sqrt\";\n"
+  "    }\n"
+  "    var guess = x / 2.0;\n"
+  "    var epsilon = 0.00001;\n"
+  "    var difference = guess * guess - x;\n"
+  "    while (difference > epsilon or difference < -epsilon) {\n"
+  "      guess = (guess + x / guess) / 2.0;\n"
+  "      difference = guess * guess - x;\n"
+  "    }\n"
+  "    return guess;\n"
+  "  }\n"
+  "}\n"
+  "\n"
+  "var Math = Math();\n";
+
+typedef struct {
+  const char* name;
+  const char* source;
+} StlModule;
+
+static const StlModule modules[] = {
+  {"Math", mathSource},
+};
+
+const char* stlModuleSource(const char* name) {
+  for (size_t i = 0; i < sizeof(modules) / sizeof(modules[0]); i++) {
+    if (strcmp(modules[i].name, name) == 0) return modules[i].source;
+  }
+  return NULL;
+}
@@ -0,0 +1,8 @@
+#ifndef embr_stl_h
+#define embr_stl_h
+
+// Standard library modules baked into the binary. Returns the module's
+// source, or NULL if the name isn't a built-in module.
+const char* stlModuleSource(const char* name);
+
+#endif
@@ -8,50 +8,104 @@
 
 #define TABLE_MAX_LOAD 0.75
 
+// Swiss-table-style probing: alongside the entries lives one control byte per
+// slot — 0x80 for empty, 0xFE for a tombstone, otherwise the top 7 bits of
+// the key's hash. Lookups scan the control bytes a word at a time and only
+// touch a 16-byte Entry when its fragment matches, so a miss usually costs a
+// single cache line of metadata instead of a pointer chase per probe. The
+// byte array carries META_GROUP - 1 mirror bytes past the end (copies of the
+// first bytes) so a group load never has to wrap.
+#define META_EMPTY     0x80
+#define META_TOMBSTONE 0xFE
+#define META_GROUP     8
+#define META_EXTRA     (META_GROUP - 1)
+
+static inline uint8_t metaFragment(uint32_t hash) {
+  return (uint8_t)(hash >> 25);
+}
+
+// 0x80 in every byte position of 'group' equal to 'byte', exact per byte
+static inline uint64_t metaMatch(uint64_t group, uint8_t byte) {
+  uint64_t x = group ^ ((uint64_t)byte * 0x0101010101010101ull);
+  uint64_t nonzero = (((x & 0x7f7f7f7f7f7f7f7full) + 0x7f7f7f7f7f7f7f7full) | x);
+  return ~(nonzero | 0x7f7f7f7f7f7f7f7full);
+}
+
+static inline int metaMatchOffset(uint64_t matches) {
+  return __builtin_ctzll(matches) >> 3;
+}
+
+static inline void metaSet(uint8_t* meta, int capacity, int index,
+                           uint8_t value) {
+  meta[index] = value;
+  if (index < META_EXTRA) meta[capacity + index] = value;
+}
+
 void initTable(Table* table) {
   table->count = 0;
   table->capacity = 0;
   table->entries = NULL;
+  table->meta = NULL;
 }
 
 void freeTable(Table* table) {
   FREE_ARRAY(Entry, table->entries, table->capacity);
+  if (table->meta != NULL) {
+    FREE_ARRAY(uint8_t, table->meta, table->capacity + META_EXTRA);
+  }
   initTable(table);
 }
 
-static Entry* findEntry(Entry* entries, int capacity,
+static Entry* findEntry(Entry* entries, uint8_t* meta, int capacity,
                         ObjString* key) {
   uint32_t index = key->hash & (capacity - 1);
+  uint8_t fragment = metaFragment(key->hash);
   Entry* tombstone = NULL;
+
   for (;;) {
-    Entry* entry = &entries[index];
-    if (entry->key == NULL) {
-      if (IS_NIL(entry->value)) {
-        // empty entry
-        return tombstone != NULL ? tombstone : entry;
-      } else {
-        // found a tombstone
-        if (tombstone == NULL) tombstone = entry;
-      }
-    } else if (entry->key == key) {
-      // found the key
-      return entry;
+    uint64_t group;
+    memcpy(&group, meta + index, sizeof(group));
+
+    uint64_t matches = metaMatch(group, fragment);
+    while (matches != 0) {
+      Entry* entry = &entries[(index + metaMatchOffset(matches)) & (capacity - 1)];
+      if (entry->key == key) return entry;
+      matches &= matches - 1;
     }
 
-    index = (index + 1) & (capacity - 1);
+    uint64_t empties = metaMatch(group, META_EMPTY);
+    uint64_t tombstones = metaMatch(group, META_TOMBSTONE);
+    // a tombstone only counts if it sits before the empty that ends the probe
+    if (empties != 0) tombstones &= (empties & -empties) - 1;
+    if (tombstone == NULL && tombstones != 0) {
+      tombstone = &entries[(index + metaMatchOffset(tombstones)) & (capacity - 1)];
+    }
+    if (empties != 0) {
+      if (tombstone != NULL) return tombstone;
+      return &entries[(index + metaMatchOffset(empties)) & (capacity - 1)];
+    }
+
+    index = (index + META_GROUP) & (capacity - 1);
   }
 }
 
 bool tableGet(Table* table, ObjString* key, Value* value) {
   if (table->count == 0) return false;
 
-  Entry* entry = findEntry(table->entries, table->capacity, key);
+  Entry* entry = findEntry(table->entries, table->meta, table->capacity, key);
   if (entry->key == NULL) return false;
 
   *value = entry->value;
   return true;
 }
 
+Entry* tableFindEntry(Table* table, ObjString* key) {
+  if (table->count == 0) return NULL;
+
+  Entry* entry = findEntry(table->entries, table->meta, table->capacity, key);
+  return entry->key == NULL ? NULL : entry;
+}
+
 static void adjustCapacity(Table* table, int capacity) {
   Entry* entries = ALLOCATE(Entry, capacity);
   for (int i = 0; i < capacity; i++) {
@@ -59,19 +113,28 @@ static void adjustCapacity(Table* table, int capacity) {
     entries[i].value = NIL_VAL;
   }
 
+  uint8_t* meta = ALLOCATE(uint8_t, capacity + META_EXTRA);
+  memset(meta, META_EMPTY, capacity + META_EXTRA);
+
   table->count = 0;
   for (int i = 0; i < table->capacity; i++) {
     Entry* entry = &table->entries[i];
     if (entry->key == NULL) continue;
 
-    Entry* dest = findEntry(entries, capacity, entry->key);
+    Entry* dest = findEntry(entries, meta, capacity, entry->key);
     dest->key = entry->key;
     dest->value = entry->value;
+    metaSet(meta, capacity, (int)(dest - entries),
+            metaFragment(entry->key->hash));
     table->count++;
   }
 
   FREE_ARRAY(Entry, table->entries, table->capacity);
+  if (table->meta != NULL) {
+    FREE_ARRAY(uint8_t, table->meta, table->capacity + META_EXTRA);
+  }
   table->entries = entries;
+  table->meta = meta;
   table->capacity = capacity;
 }
 
@@ -80,12 +143,14 @@ bool tableSet(Table* table, ObjString* key, Value value) {
     int capacity = GROW_CAPACITY(table->capacity);
     adjustCapacity(table, capacity);
   }
-  Entry* entry = findEntry(table->entries, table->capacity, key);
+  Entry* entry = findEntry(table->entries, table->meta, table->capacity, key);
   bool isNewKey = entry->key == NULL;
   if (isNewKey && IS_NIL(entry->value)) table->count++;
 
   entry->key = key;
   entry->value = value;
+  metaSet(table->meta, table->capacity, (int)(entry - table->entries),
+          metaFragment(key->hash));
   return isNewKey;
 }
 
@@ -93,12 +158,14 @@ bool tableDelete(Table* table, ObjString* key) {
   if (table->count == 0) return false;
 
   // find the entry
-  Entry* entry = findEntry(table->entries, table->capacity, key);
+  Entry* entry = findEntry(table->entries, table->meta, table->capacity, key);
   if (entry->key == NULL) return false;
 
   // kill it
   entry->key = NULL;
   entry->value = BOOL_VAL(true);
+  metaSet(table->meta, table->capacity, (int)(entry - table->entries),
+          META_TOMBSTONE);
   return true;
 }
 
@@ -111,23 +178,205 @@ void tableAddAll(Table* from, Table* to) {
   }
 }
 
+void tableRemoveWhite(Table* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    if (entry->key != NULL && !entry->key->obj.isMarked) {
+      tableDelete(table, entry->key);
+    }
+  }
+}
+
+void markTable(Table* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    Entry* entry = &table->entries[i];
+    markObject((Obj*)entry->key);
+    markValue(entry->value);
+  }
+}
+
 ObjString* tableFindString(Table* table, const char* chars,
                           int length, uint32_t hash) {
   if (table->count == 0) return NULL;
 
   uint32_t index = hash & (table->capacity - 1);
+  uint8_t fragment = metaFragment(hash);
+  for (;;) {
+    uint64_t group;
+    memcpy(&group, table->meta + index, sizeof(group));
+
+    uint64_t matches = metaMatch(group, fragment);
+    while (matches != 0) {
+      Entry* entry =
+          &table->entries[(index + metaMatchOffset(matches)) &
+                          (table->capacity - 1)];
+      if (entry->key->length == length && entry->key->hash == hash &&
+          memcmp(entry->key->chars, chars, length) == 0) {
+        // we found it
+        return entry->key;
+      }
+      matches &= matches - 1;
+    }
+
+    // stop if the group holds an empty nontombstone slot
+    if (metaMatch(group, META_EMPTY) != 0) return NULL;
+
+    index = (index + META_GROUP) & (table->capacity - 1);
+  }
+}
+
+// Value-keyed tables hash the NaN-boxed bits directly: a number is its double
+// bits, an object its pointer, so no key ever needs stringifying first.
+static uint32_t hashValue(Value value) {
+  // +0.0 and -0.0 compare equal, so they have to land in the same slot
+  if (IS_NUMBER(value) && AS_NUMBER(value) == 0) value = NUMBER_VAL(0);
+  uint64_t hash = (uint64_t)value * 0x2545f4914f6cdd1dull;
+  hash ^= hash >> 32;
+  hash *= 0x2545f4914f6cdd1dull;
+  hash ^= hash >> 29;
+  return (uint32_t)hash;
+}
+
+// Key lookups can't use valuesEqual directly: NaN never compares equal to
+// itself, so a NaN key could be stored but never found or deleted again
+// (every store would quietly append another unreachable entry). Number keys
+// compare by their boxed bits instead, normalizing -0.0 like hashValue does.
+static bool keysEqual(Value a, Value b) {
+  if (IS_NUMBER(a) && IS_NUMBER(b)) {
+    if (AS_NUMBER(a) == 0) a = NUMBER_VAL(0);
+    if (AS_NUMBER(b) == 0) b = NUMBER_VAL(0);
+    return a == b;
+  }
+  return valuesEqual(a, b);
+}
+
+void initValueTable(ValueTable* table) {
+  table->count = 0;
+  table->capacity = 0;
+  table->entries = NULL;
+  table->meta = NULL;
+}
+
+void freeValueTable(ValueTable* table) {
+  FREE_ARRAY(ValueEntry, table->entries, table->capacity);
+  if (table->meta != NULL) {
+    FREE_ARRAY(uint8_t, table->meta, table->capacity + META_EXTRA);
+  }
+  initValueTable(table);
+}
+
+static ValueEntry* findValueEntry(ValueEntry* entries, uint8_t* meta,
+                                  int capacity, Value key, uint32_t hash) {
+  uint32_t index = hash & (capacity - 1);
+  uint8_t fragment = metaFragment(hash);
+  ValueEntry* tombstone = NULL;
+
   for (;;) {
-    Entry* entry = &table->entries[index];
-    if (entry->key == NULL) {
-      // stop if we find an empty nontombstone entry
-      if (IS_NIL(entry->value)) return NULL;
-    } else if (entry->key->length == length &&
-        entry->key->hash == hash &&
-        memcmp(entry->key->chars, chars, length) == 0) {
-      // we found it
-      return entry->key;
+    uint64_t group;
+    memcpy(&group, meta + index, sizeof(group));
+
+    uint64_t matches = metaMatch(group, fragment);
+    while (matches != 0) {
+      ValueEntry* entry =
+          &entries[(index + metaMatchOffset(matches)) & (capacity - 1)];
+      if (keysEqual(entry->key, key)) return entry;
+      matches &= matches - 1;
+    }
+
+    uint64_t empties = metaMatch(group, META_EMPTY);
+    uint64_t tombstones = metaMatch(group, META_TOMBSTONE);
+    if (empties != 0) tombstones &= (empties & -empties) - 1;
+    if (tombstone == NULL && tombstones != 0) {
+      tombstone = &entries[(index + metaMatchOffset(tombstones)) & (capacity - 1)];
+    }
+    if (empties != 0) {
+      if (tombstone != NULL) return tombstone;
+      return &entries[(index + metaMatchOffset(empties)) & (capacity - 1)];
     }
 
-    index = (index + 1) & (table->capacity - 1);
+    index = (index + META_GROUP) & (capacity - 1);
+  }
+}
+
+static void adjustValueCapacity(ValueTable* table, int capacity) {
+  ValueEntry* entries = ALLOCATE(ValueEntry, capacity);
+  for (int i = 0; i < capacity; i++) {
+    entries[i].key = UNDEFINED_VAL;
+    entries[i].value = NIL_VAL;
+  }
+
+  uint8_t* meta = ALLOCATE(uint8_t, capacity + META_EXTRA);
+  memset(meta, META_EMPTY, capacity + META_EXTRA);
+
+  table->count = 0;
+  for (int i = 0; i < table->capacity; i++) {
+    ValueEntry* entry = &table->entries[i];
+    if (IS_UNDEFINED(entry->key)) continue;
+
+    uint32_t hash = hashValue(entry->key);
+    ValueEntry* dest = findValueEntry(entries, meta, capacity, entry->key, hash);
+    dest->key = entry->key;
+    dest->value = entry->value;
+    metaSet(meta, capacity, (int)(dest - entries), metaFragment(hash));
+    table->count++;
+  }
+
+  FREE_ARRAY(ValueEntry, table->entries, table->capacity);
+  if (table->meta != NULL) {
+    FREE_ARRAY(uint8_t, table->meta, table->capacity + META_EXTRA);
+  }
+  table->entries = entries;
+  table->meta = meta;
+  table->capacity = capacity;
+}
+
+bool valueTableGet(ValueTable* table, Value key, Value* value) {
+  if (table->count == 0) return false;
+
+  ValueEntry* entry = findValueEntry(table->entries, table->meta,
+                                     table->capacity, key, hashValue(key));
+  if (IS_UNDEFINED(entry->key)) return false;
+
+  *value = entry->value;
+  return true;
+}
+
+bool valueTableSet(ValueTable* table, Value key, Value value) {
+  if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
+    int capacity = GROW_CAPACITY(table->capacity);
+    adjustValueCapacity(table, capacity);
+  }
+  uint32_t hash = hashValue(key);
+  ValueEntry* entry = findValueEntry(table->entries, table->meta,
+                                     table->capacity, key, hash);
+  bool isNewKey = IS_UNDEFINED(entry->key);
+  if (isNewKey && IS_NIL(entry->value)) table->count++;
+
+  entry->key = key;
+  entry->value = value;
+  metaSet(table->meta, table->capacity, (int)(entry - table->entries),
+          metaFragment(hash));
+  return isNewKey;
+}
+
+bool valueTableDelete(ValueTable* table, Value key) {
+  if (table->count == 0) return false;
+
+  ValueEntry* entry = findValueEntry(table->entries, table->meta,
+                                     table->capacity, key, hashValue(key));
+  if (IS_UNDEFINED(entry->key)) return false;
+
+  entry->key = UNDEFINED_VAL;
+  entry->value = BOOL_VAL(true);
+  metaSet(table->meta, table->capacity, (int)(entry - table->entries),
+          META_TOMBSTONE);
+  return true;
+}
+
+void markValueTable(ValueTable* table) {
+  for (int i = 0; i < table->capacity; i++) {
+    ValueEntry* entry = &table->entries[i];
+    markValue(entry->key);
+    markValue(entry->value);
   }
 }
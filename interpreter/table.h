@@ -13,14 +13,44 @@ typedef struct {
   int count;
   int capacity;
   Entry* entries;
+  // one control byte per slot (empty / tombstone / 7-bit hash fragment),
+  // probed a word at a time before any Entry is touched
+  uint8_t* meta;
 } Table;
 
+// dict storage: same slot-plus-control-byte layout as Table, but keyed by
+// whole Values hashed on their NaN-boxed bits, so numbers (and any other
+// value) work as keys without a trip through number-to-string conversion.
+// Interned strings keep working because equal strings share one pointer and
+// therefore one bit pattern. Empty slots hold the UNDEFINED_VAL sentinel.
+typedef struct {
+  Value key;
+  Value value;
+} ValueEntry;
+
+typedef struct {
+  int count;
+  int capacity;
+  ValueEntry* entries;
+  uint8_t* meta;
+} ValueTable;
+
 void initTable(Table* table);
 void freeTable(Table* table);
 bool tableGet(Table* table, ObjString* key, Value* value);
+Entry* tableFindEntry(Table* table, ObjString* key);
 bool tableSet(Table* table, ObjString* key, Value value);
 bool tableDelete(Table* table, ObjString* key);
 void tableAddAll(Table* from, Table* to);
 ObjString* tableFindString(Table* table, const char* chars, int length, uint32_t hash);
+void tableRemoveWhite(Table* table);
+void markTable(Table* table);
+
+void initValueTable(ValueTable* table);
+void freeValueTable(ValueTable* table);
+bool valueTableGet(ValueTable* table, Value key, Value* value);
+bool valueTableSet(ValueTable* table, Value key, Value value);
+bool valueTableDelete(ValueTable* table, Value key);
+void markValueTable(ValueTable* table);
 
 #endif
@@ -13,22 +13,26 @@ typedef struct ObjString ObjString;
 #define SIGN_BIT ((uint64_t)0x8000000000000000)
 #define QNAN     ((uint64_t)0x7ffc000000000000)
 
-#define TAG_NIL   1 // 01
-#define TAG_FALSE 2 // 10
-#define TAG_TRUE  3 // 11
+#define TAG_NIL       1 // 001
+#define TAG_FALSE     2 // 010
+#define TAG_TRUE      3 // 011
+#define TAG_UNDEFINED 4 // 100 (internal sentinel, never visible to programs)
 
 typedef uint64_t Value;
 
 #define IS_ARRAY(value)     isObjType(value, OBJ_ARRAY)
 #define IS_DICT(value)      isObjType(value, OBJ_DICT)
+#define IS_FLOAT_ARRAY(value) isObjType(value, OBJ_FLOAT_ARRAY)
 #define IS_BOOL(value)      (((value) | 1) == TRUE_VAL)
 #define IS_NIL(value)       ((value) == NIL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
 #define IS_NUMBER(value)    (((value) & QNAN) != QNAN)
 #define IS_OBJ(value) \
     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
 
 #define AS_ARRAY(value)     ((ObjArray*)AS_OBJ(value))
 #define AS_DICT(value)      ((ObjDict*)AS_OBJ(value))
+#define AS_FLOAT_ARRAY(value) ((ObjFloatArray*)AS_OBJ(value))
 #define AS_BOOL(value)      ((value) == TRUE_VAL)
 #define AS_NUMBER(value)    valueToNum(value)
 #define AS_BINARY(value)    valueToBin(value)
@@ -37,10 +41,12 @@ typedef uint64_t Value;
 
 #define ARRAY_VAL(obj)  (OBJ_VAL(obj))
 #define DICT_VAL(obj)   (OBJ_VAL(obj))
+#define FLOAT_ARRAY_VAL(obj) (OBJ_VAL(obj))
 #define BOOL_VAL(b)     ((b) ? TRUE_VAL : FALSE_VAL)
 #define FALSE_VAL       ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL        ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL         ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL   ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
 #define NUMBER_VAL(num) numToValue(num)
 #define BINARY_VAL(val) binaryToValue(val)
 #define OBJ_VAL(obj) \
@@ -69,6 +75,7 @@ static inline Value numToValue(double num) {
 typedef enum {
   VAL_BOOL,
   VAL_NIL,
+  VAL_UNDEFINED, // internal sentinel, never visible to programs
   VAL_NUMBER,
   VAL_OBJ
 } ValueType;
@@ -84,6 +91,7 @@ typedef struct {
 
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)      ((value).type == VAL_OBJ)
 
@@ -93,6 +101,7 @@ typedef struct {
 
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
+#define UNDEFINED_VAL     ((Value){VAL_UNDEFINED, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
@@ -4,16 +4,22 @@
 #include <time.h>
 #include <math.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "embr_native.h"
+#include "heapstats.h"
+#include "loop.h"
 #include "object.h"
 #include "memory.h"
+#include "profile.h"
 #include "value.h"
 #include "vm.h"
+#include "worker.h"
 
-VM vm;
+_Thread_local VM vm;
 
 static Value arrayPrepend(int argCount, Value* args);
 static Value arrayAppend(int argCount, Value* args);
@@ -46,7 +52,10 @@ static Value lengthNative(int argCount, Value* args) {
     return NUMBER_VAL((double)string->length);
   } else if (IS_ARRAY(args[0])) {
     ObjArray* array = AS_ARRAY(args[0]);
-    return NUMBER_VAL((double)array->elements.count);
+    return NUMBER_VAL((double)array->count);
+  } else if (IS_FLOAT_ARRAY(args[0])) {
+    ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+    return NUMBER_VAL((double)array->count);
   } else {
     runtimeError("SKILL ISSUE: Argument to length() must be a string or an array.");
     return NIL_VAL;
@@ -83,12 +92,7 @@ static Value arrayPrepend(int argCount, Value* args) {
   ObjArray* array = AS_ARRAY(args[0]);
   Value value = args[1];
 
-  // shift elements to the right
-  writeArray(array, NIL_VAL); // add a new slot at the end
-  for (int i = array->elements.count - 1; i > 0; i--) {
-    array->elements.values[i] = array->elements.values[i - 1];
-  }
-  array->elements.values[0] = value;
+  prependArray(array, value);
 
   return NIL_VAL;
 }
@@ -115,17 +119,15 @@ static Value arrayHead(int argCount, Value* args) {
 
   ObjArray* array = AS_ARRAY(args[0]);
 
-  if (array->elements.count == 0) {
+  if (array->count == 0) {
     runtimeError("SKILL ISSUE: head() called on an empty array.");
     return NIL_VAL;
   }
 
-  Value value = array->elements.values[0];
-  // shift elements to the left
-  for (int i = 0; i < array->elements.count - 1; i++) {
-    array->elements.values[i] = array->elements.values[i + 1];
-  }
-  array->elements.count--;
+  // just slide the window forward
+  Value value = array->values[0];
+  array->values++;
+  array->count--;
 
   return value;
 }
@@ -138,13 +140,13 @@ static Value arrayTail(int argCount, Value* args) {
 
   ObjArray* array = AS_ARRAY(args[0]);
 
-  if (array->elements.count == 0) {
+  if (array->count == 0) {
     runtimeError("SKILL ISSUE: tail() called on an empty array.");
     return NIL_VAL;
   }
 
-  Value value = array->elements.values[array->elements.count - 1];
-  array->elements.count--;
+  Value value = array->values[array->count - 1];
+  array->count--;
 
   return value;
 }
@@ -156,28 +158,203 @@ static Value arrayRest(int argCount, Value* args) {
   }
 
   ObjArray* array = AS_ARRAY(args[0]);
-  if (array->elements.count == 0) {
+  if (array->count == 0) {
     runtimeError("SKILL ISSUE: rest() called on an empty array.");
     return NIL_VAL;
   }
 
-  ObjArray* anewArray = newArray();
-  for (int i = 1; i < array->elements.count; i++) {
-    writeArray(anewArray, array->elements.values[i]);
+  return ARRAY_VAL(restArray(array));
+}
+
+// substrings go through copyString(), so the intern table takes the place of
+// a slice representation: every substring already seen — and protocol tokens
+// repeat constantly — comes back as the existing ObjString with no allocation
+static Value sliceNative(int argCount, Value* args) {
+  if (argCount != 3 || !IS_STRING(args[0]) || !IS_NUMBER(args[1]) ||
+      !IS_NUMBER(args[2])) {
+    runtimeError("SKILL ISSUE: slice() takes exactly 3 arguments: string, start, end.");
+    return NIL_VAL;
+  }
+
+  ObjString* string = AS_STRING(args[0]);
+  int start = (int)AS_NUMBER(args[1]);
+  int end = (int)AS_NUMBER(args[2]);
+  if (start < 0) start = 0;
+  if (end > string->length) end = string->length;
+  if (end < start) end = start;
+
+  return OBJ_VAL(copyString(string->chars + start, end - start));
+}
+
+static Value findNative(int argCount, Value* args) {
+  if (argCount < 2 || argCount > 3 || !IS_STRING(args[0]) ||
+      !IS_STRING(args[1]) || (argCount == 3 && !IS_NUMBER(args[2]))) {
+    runtimeError("SKILL ISSUE: find() takes a string, a needle, and an optional start index.");
+    return NIL_VAL;
+  }
+
+  ObjString* haystack = AS_STRING(args[0]);
+  ObjString* needle = AS_STRING(args[1]);
+  int from = argCount == 3 ? (int)AS_NUMBER(args[2]) : 0;
+  if (from < 0) from = 0;
+
+  for (int i = from; i + needle->length <= haystack->length; i++) {
+    if (memcmp(haystack->chars + i, needle->chars, needle->length) == 0) {
+      return NUMBER_VAL((double)i);
+    }
+  }
+
+  return NUMBER_VAL(-1);
+}
+
+// builds one string from an array of parts in a single pass, so assembling a
+// large report stays linear instead of the quadratic copy-per-'+' of chained
+// concatenation. Parts may be strings or numbers (numbers format the same way
+// they print); the optional second argument goes between parts.
+static Value joinNative(int argCount, Value* args) {
+  if (argCount < 1 || argCount > 2 || !IS_ARRAY(args[0]) ||
+      (argCount == 2 && !IS_STRING(args[1]))) {
+    runtimeError("SKILL ISSUE: join() takes an array and an optional separator string.");
+    return NIL_VAL;
+  }
+
+  ObjArray* parts = AS_ARRAY(args[0]);
+  ObjString* separator = argCount == 2 ? AS_STRING(args[1]) : NULL;
+
+  size_t length = 0;
+  for (int i = 0; i < parts->count; i++) {
+    Value part = parts->values[i];
+    if (IS_STRING(part)) {
+      length += AS_STRING(part)->length;
+    } else if (IS_NUMBER(part)) {
+      char scratch[32];
+      length += snprintf(scratch, sizeof(scratch), "%g", AS_NUMBER(part));
+    } else {
+      runtimeError("SKILL ISSUE: join() parts must be strings or numbers.");
+      return NIL_VAL;
+    }
+    if (separator != NULL && i < parts->count - 1) {
+      length += separator->length;
+    }
+  }
+
+  char* chars = ALLOCATE(char, length + 1);
+  size_t at = 0;
+  for (int i = 0; i < parts->count; i++) {
+    Value part = parts->values[i];
+    if (IS_STRING(part)) {
+      ObjString* string = AS_STRING(part);
+      memcpy(chars + at, string->chars, string->length);
+      at += string->length;
+    } else {
+      at += snprintf(chars + at, 32, "%g", AS_NUMBER(part));
+    }
+    if (separator != NULL && i < parts->count - 1) {
+      memcpy(chars + at, separator->chars, separator->length);
+      at += separator->length;
+    }
+  }
+  chars[at] = '\0';
+
+  return OBJ_VAL(takeString(chars, (int)at));
+}
+
+static Value floatsNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_NUMBER(args[0]) || AS_NUMBER(args[0]) < 0) {
+    runtimeError("SKILL ISSUE: floats() takes exactly 1 argument: a non-negative length.");
+    return NIL_VAL;
+  }
+
+  return FLOAT_ARRAY_VAL(newFloatArray((int)AS_NUMBER(args[0])));
+}
+
+// the bulk kernels run over the contiguous double buffer with plain loops so
+// the compiler is free to vectorize them
+static Value vsumNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_FLOAT_ARRAY(args[0])) {
+    runtimeError("SKILL ISSUE: vsum() takes exactly 1 argument: a float array.");
+    return NIL_VAL;
+  }
+
+  ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+  const double* restrict values = array->values;
+  double sum = 0;
+  for (int i = 0; i < array->count; i++) {
+    sum += values[i];
+  }
+
+  return NUMBER_VAL(sum);
+}
+
+static Value vscaleNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_FLOAT_ARRAY(args[0]) || !IS_NUMBER(args[1])) {
+    runtimeError("SKILL ISSUE: vscale() takes exactly 2 arguments: float array and factor.");
+    return NIL_VAL;
+  }
+
+  ObjFloatArray* array = AS_FLOAT_ARRAY(args[0]);
+  double* restrict values = array->values;
+  double factor = AS_NUMBER(args[1]);
+  for (int i = 0; i < array->count; i++) {
+    values[i] *= factor;
+  }
+
+  return args[0];
+}
+
+static Value vaddNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_FLOAT_ARRAY(args[0]) || !IS_FLOAT_ARRAY(args[1])) {
+    runtimeError("SKILL ISSUE: vadd() takes exactly 2 arguments: two float arrays.");
+    return NIL_VAL;
+  }
+
+  ObjFloatArray* a = AS_FLOAT_ARRAY(args[0]);
+  ObjFloatArray* b = AS_FLOAT_ARRAY(args[1]);
+  if (a->count != b->count) {
+    runtimeError("SKILL ISSUE: vadd() arrays must have the same length.");
+    return NIL_VAL;
+  }
+
+  double* restrict out = a->values;
+  const double* restrict in = b->values;
+  for (int i = 0; i < a->count; i++) {
+    out[i] += in[i];
   }
 
-  return ARRAY_VAL(anewArray);
+  return args[0];
+}
+
+static Value vdotNative(int argCount, Value* args) {
+  if (argCount != 2 || !IS_FLOAT_ARRAY(args[0]) || !IS_FLOAT_ARRAY(args[1])) {
+    runtimeError("SKILL ISSUE: vdot() takes exactly 2 arguments: two float arrays.");
+    return NIL_VAL;
+  }
+
+  ObjFloatArray* a = AS_FLOAT_ARRAY(args[0]);
+  ObjFloatArray* b = AS_FLOAT_ARRAY(args[1]);
+  if (a->count != b->count) {
+    runtimeError("SKILL ISSUE: vdot() arrays must have the same length.");
+    return NIL_VAL;
+  }
+
+  const double* restrict av = a->values;
+  const double* restrict bv = b->values;
+  double sum = 0;
+  for (int i = 0; i < a->count; i++) {
+    sum += av[i] * bv[i];
+  }
+
+  return NUMBER_VAL(sum);
 }
 
 static Value dictRemove(int argCount, Value* args) {
-  if (argCount != 2 || !IS_DICT(args[0]) || !IS_STRING(args[1])) {
+  if (argCount != 2 || !IS_DICT(args[0])) {
     runtimeError("SKILL ISSUE: delete() takes exactly 2 arguments: dictionary and key.");
     return NIL_VAL;
   }
 
   ObjDict* dict = AS_DICT(args[0]);
-  ObjString* key = AS_STRING(args[1]);
-  tableDelete(&dict->items, key);
+  valueTableDelete(&dict->items, args[1]);
 
   return NIL_VAL;
 }
@@ -188,7 +365,145 @@ static void resetStack() {
   vm.openUpvalues = NULL;
 }
 
+void vmOutFlush() {
+  size_t written = 0;
+  while (written < vm.outCount) {
+    ssize_t n = write(vm.outFd, vm.outBuffer + written, vm.outCount - written);
+    if (n <= 0) break; // bad descriptor or closed pipe; drop the rest
+    written += (size_t)n;
+  }
+  vm.outCount = 0;
+}
+
+static void outWrite(const char* data, size_t length) {
+  if (vm.outCount + length > OUT_BUFFER_SIZE) {
+    vmOutFlush();
+    if (length > OUT_BUFFER_SIZE) {
+      // larger than the whole buffer: hand it to the descriptor directly
+      size_t written = 0;
+      while (written < length) {
+        ssize_t n = write(vm.outFd, data + written, length - written);
+        if (n <= 0) return;
+        written += (size_t)n;
+      }
+      return;
+    }
+  }
+  memcpy(vm.outBuffer + vm.outCount, data, length);
+  vm.outCount += length;
+}
+
+static void outCString(const char* text) {
+  outWrite(text, strlen(text));
+}
+
+// same rendering as printValue, but into the output buffer
+static void outValue(Value value) {
+  if (IS_BOOL(value)) {
+    outCString(AS_BOOL(value) ? "true" : "false");
+  } else if (IS_NIL(value)) {
+    outCString("nil");
+  } else if (IS_NUMBER(value)) {
+    char text[32];
+    outWrite(text, snprintf(text, sizeof(text), "%g", AS_NUMBER(value)));
+  } else {
+    switch (OBJ_TYPE(value)) {
+      case OBJ_STRING: {
+        ObjString* string = AS_STRING(value);
+        outWrite(string->chars, string->length);
+        break;
+      }
+      case OBJ_ARRAY: {
+        ObjArray* array = AS_ARRAY(value);
+        outCString("[");
+        for (int i = 0; i < array->count; i++) {
+          outValue(array->values[i]);
+          if (i < array->count - 1) outCString(", ");
+        }
+        outCString("]");
+        break;
+      }
+      case OBJ_FLOAT_ARRAY: {
+        ObjFloatArray* array = AS_FLOAT_ARRAY(value);
+        outCString("[");
+        for (int i = 0; i < array->count; i++) {
+          outValue(NUMBER_VAL(array->values[i]));
+          if (i < array->count - 1) outCString(", ");
+        }
+        outCString("]");
+        break;
+      }
+      case OBJ_DICT: {
+        ObjDict* dict = AS_DICT(value);
+        outCString("{");
+        bool first = true;
+        for (int i = 0; i < dict->items.capacity; i++) {
+          ValueEntry* entry = &dict->items.entries[i];
+          if (IS_UNDEFINED(entry->key)) continue;
+          if (!first) outCString(", ");
+          first = false;
+          outValue(entry->key);
+          outCString(": ");
+          outValue(entry->value);
+        }
+        outCString("}");
+        break;
+      }
+      case OBJ_CLOSURE:
+        outValue(OBJ_VAL(AS_CLOSURE(value)->function));
+        break;
+      case OBJ_BOUND_METHOD:
+        outValue(OBJ_VAL(AS_BOUND_METHOD(value)->method->function));
+        break;
+      case OBJ_FUNCTION: {
+        ObjFunction* function = AS_FUNCTION(value);
+        if (function->name == NULL) {
+          outCString("<script>");
+        } else {
+          outCString("<fn ");
+          outWrite(function->name->chars, function->name->length);
+          outCString(">");
+        }
+        break;
+      }
+      case OBJ_CLASS:
+        outCString(AS_CLASS(value)->name->chars);
+        break;
+      case OBJ_INSTANCE:
+        outCString(AS_INSTANCE(value)->klass->name->chars);
+        outCString(" instance");
+        break;
+      case OBJ_NATIVE:
+        outCString("<native fn>");
+        break;
+      case OBJ_UPVALUE:
+        outCString("upvalue");
+        break;
+    }
+  }
+}
+
+static Value flushNative(int argCount, Value* args) {
+  vmOutFlush();
+  return NIL_VAL;
+}
+
+static Value redirectNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_NUMBER(args[0])) {
+    runtimeError("SKILL ISSUE: redirect() takes a file descriptor number.");
+    return NIL_VAL;
+  }
+
+  // pending bytes belong to the old destination
+  vmOutFlush();
+  vm.outFd = (int)AS_NUMBER(args[0]);
+  return NIL_VAL;
+}
+
 static void runtimeError(const char* format, ...) {
+  // keep buffered output ordered ahead of the error report
+  vmOutFlush();
+
   va_list args;
   va_start(args, format);
   vfprintf(stderr, format, args);
@@ -211,15 +526,99 @@ static void runtimeError(const char* format, ...) {
   resetStack();
 }
 
+// resolves a global name to its slot in vm.globalValues, creating the slot
+// (initialized to the undefined sentinel) on first mention. The compiler
+// calls this, so forward references get a slot up front and simply fail the
+// undefined check at runtime if they are read before being defined.
+int globalSlot(ObjString* name) {
+  Value slot;
+  if (tableGet(&vm.globals, name, &slot)) return (int)AS_NUMBER(slot);
+
+  push(OBJ_VAL(name));
+  writeValueArray(&vm.globalNames, OBJ_VAL(name));
+  writeValueArray(&vm.globalValues, UNDEFINED_VAL);
+  int index = vm.globalNames.count - 1;
+  tableSet(&vm.globals, name, NUMBER_VAL((double)index));
+  pop();
+  return index;
+}
+
 static void defineNative(const char* name, NativeFn function) {
   push(OBJ_VAL(copyString(name, (int)strlen(name))));
   push(OBJ_VAL(newNative(function)));
-  tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+  int slot = globalSlot(AS_STRING(vm.stack[0]));
+  vm.globalValues.values[slot] = vm.stack[1];
   pop();
   pop();
 }
 
+// ---- host API for native modules ----
+// ffi.c hands this table to each module's embrModuleInit. EmbrValue is the
+// NaN-boxed Value bit pattern, so the wrappers are just the usual macros
+// behind a stable calling convention.
+_Static_assert(sizeof(Value) == sizeof(EmbrValue),
+               "native module ABI assumes NaN-boxed values");
+
+static void apiDefineNative(const char* name, EmbrNativeFn function) {
+  // registration happens at import time, when the stack need not be empty,
+  // so unlike defineNative this addresses the two GC roots from the top
+  push(OBJ_VAL(copyString(name, (int)strlen(name))));
+  push(OBJ_VAL(newNative((NativeFn)function)));
+  int slot = globalSlot(AS_STRING(vm.stackTop[-2]));
+  vm.globalValues.values[slot] = vm.stackTop[-1];
+  pop();
+  pop();
+}
+
+static EmbrValue apiNumberValue(double number) { return NUMBER_VAL(number); }
+static bool apiIsNumber(EmbrValue value) { return IS_NUMBER(value); }
+static double apiAsNumber(EmbrValue value) { return AS_NUMBER(value); }
+
+static EmbrValue apiBoolValue(bool boolean) { return BOOL_VAL(boolean); }
+static bool apiIsBool(EmbrValue value) { return IS_BOOL(value); }
+static bool apiAsBool(EmbrValue value) { return AS_BOOL(value); }
+static EmbrValue apiNilValue(void) { return NIL_VAL; }
+static bool apiIsNil(EmbrValue value) { return IS_NIL(value); }
+
+static EmbrValue apiStringValue(const char* chars, int length) {
+  return OBJ_VAL(copyString(chars, length));
+}
+static bool apiIsString(EmbrValue value) { return IS_STRING(value); }
+static const char* apiAsCString(EmbrValue value) { return AS_CSTRING(value); }
+static int apiStringLength(EmbrValue value) { return AS_STRING(value)->length; }
+
+static void apiError(const char* message) {
+  runtimeError("%s", message);
+}
+
+const EmbrHostApi* embrHostApi() {
+  static const EmbrHostApi api = {
+    .abiVersion = EMBR_ABI_VERSION,
+    .defineNative = apiDefineNative,
+    .numberValue = apiNumberValue,
+    .isNumber = apiIsNumber,
+    .asNumber = apiAsNumber,
+    .boolValue = apiBoolValue,
+    .isBool = apiIsBool,
+    .asBool = apiAsBool,
+    .nilValue = apiNilValue,
+    .isNil = apiIsNil,
+    .stringValue = apiStringValue,
+    .isString = apiIsString,
+    .asCString = apiAsCString,
+    .stringLength = apiStringLength,
+    .error = apiError,
+  };
+  return &api;
+}
+
 void initVM() {
+  vm.bytesAllocated = 0;
+  vm.nextGC = GC_INITIAL_THRESHOLD;
+  vm.grayCount = 0;
+  vm.grayCapacity = 0;
+  vm.grayStack = NULL;
+
   vm.stackCapacity = INITIAL_STACK_MAX;
   vm.stack = ALLOCATE(Value, vm.stackCapacity);
   vm.stackTop = vm.stack;
@@ -228,11 +627,21 @@ void initVM() {
   vm.frames = ALLOCATE(CallFrame, vm.framesCapacity);
 
   resetStack();
+  vm.stopFrame = 0;
+  vm.lastReturn = NIL_VAL;
   vm.objects = NULL;
 
+  vm.shapes = NULL;
+  vm.rootShape = newShape();
+
   initTable(&vm.globals);
+  initValueArray(&vm.globalValues);
+  initValueArray(&vm.globalNames);
   initTable(&vm.strings);
 
+  vm.outFd = STDOUT_FILENO;
+  vm.outCount = 0;
+
   vm.initString = NULL;
   vm.initString = copyString("init", 4);
 
@@ -246,15 +655,49 @@ void initVM() {
   defineNative("rest", arrayRest);
   defineNative("remove", dictRemove);
   defineNative("length", lengthNative);
+  defineNative("join", joinNative);
+  defineNative("slice", sliceNative);
+  defineNative("find", findNative);
+  defineNative("floats", floatsNative);
+  defineNative("vsum", vsumNative);
+  defineNative("vscale", vscaleNative);
+  defineNative("vadd", vaddNative);
+  defineNative("vdot", vdotNative);
+  defineNative("flush", flushNative);
+  defineNative("redirect", redirectNative);
+  defineNative("spawn", spawnNative);
+  defineNative("send", sendNative);
+  defineNative("receive", receiveNative);
+  defineNative("wait", waitNative);
+  defineNative("pmap", pmapNative);
+  defineNative("pfilter", pfilterNative);
+  defineNative("preduce", preduceNative);
+  defineNative("defer", deferNative);
+  defineNative("delay", delayNative);
+  defineNative("every", everyNative);
+  defineNative("cancel", cancelNative);
+  defineNative("watch", watchNative);
+  defineNative("heapStats", heapStatsNative);
 }
 
 void freeVM() {
+  vmOutFlush();
+  #ifdef DEBUG_PROFILE
+  profileDump();
+  #endif
+  #ifdef DEBUG_HEAP_STATS
+  heapStatsDump();
+  #endif
+  freeEventLoop();
   freeTable(&vm.globals);
+  freeValueArray(&vm.globalValues);
+  freeValueArray(&vm.globalNames);
   freeTable(&vm.strings);
   vm.initString = NULL;
   FREE_ARRAY(Value, vm.stack, vm.stackCapacity);
   FREE_ARRAY(CallFrame, vm.frames, vm.framesCapacity);
   freeObjects();
+  freeShapes();
 }
 
 void push(Value value) {
@@ -356,7 +799,7 @@ static bool invokeFromClass(ObjClass* klass, ObjString* name, int argCount) {
   return call(AS_CLOSURE(method), argCount);
 }
 
-static bool invoke(ObjString* name, int argCount) {
+static bool invoke(ObjString* name, int argCount, InlineCache* cache) {
   Value receiver = peek(argCount);
 
   if (!IS_INSTANCE(receiver)) {
@@ -367,12 +810,35 @@ static bool invoke(ObjString* name, int argCount) {
   ObjInstance* instance = AS_INSTANCE(receiver);
 
   Value value;
-  if (tableGet(&instance->fields, name, &value)) {
+  if (instanceGetField(instance, name, &value)) {
     vm.stackTop[-argCount - 1] = value;
     return callValue(value, argCount);
   }
 
-  return invokeFromClass(instance->klass, name, argCount);
+  Value method;
+  if (!tableGet(&instance->klass->methods, name, &method)) {
+    runtimeError("SKILL ISSUE: Undefined property '%s'.", name->chars);
+    return false;
+  }
+
+  // remember what this site resolved to, demoting the previous entry to the
+  // second way; field-shadowed calls never get this far so the cache only
+  // ever holds real method dispatches
+  if (cache->kind != CACHE_INVOKE) {
+    cache->kind = CACHE_INVOKE;
+    cache->id2 = NULL;
+    cache->payload2 = NULL;
+    cache->shape2 = NULL;
+  } else {
+    cache->id2 = cache->id;
+    cache->payload2 = cache->payload;
+    cache->shape2 = cache->shape;
+  }
+  cache->id = instance->klass;
+  cache->payload = AS_CLOSURE(method);
+  cache->shape = instance->shape;
+
+  return call(AS_CLOSURE(method), argCount);
 }
 
 static bool bindMethod(ObjClass* klass, ObjString* name) {
@@ -452,12 +918,36 @@ static void concatenate() {
 
 static InterpretResult run() {
   CallFrame* frame = &vm.frames[vm.frameCount - 1];
-
-  #define READ_BYTE() (*frame->ip++)
+  register uint8_t* ip = frame->ip;
+  register Value* sp = vm.stackTop;
+
+  // the instruction pointer and stack pointer live in locals so the hot
+  // handlers stay out of memory; STORE_FRAME spills them back into the VM
+  // before anything that can allocate (the GC walks vm.stackTop for roots),
+  // report an error (stack traces read frame->ip), or switch frames
+  #define STORE_FRAME() (frame->ip = ip, vm.stackTop = sp)
+  #define LOAD_FRAME() \
+      (frame = &vm.frames[vm.frameCount - 1], \
+      ip = frame->ip, \
+      sp = vm.stackTop)
+
+  #define PUSH(value) \
+      do { \
+        if (sp == vm.stack + vm.stackCapacity) { \
+          vm.stackTop = sp; \
+          growStack(); \
+          sp = vm.stackTop; \
+        } \
+        *sp++ = (value); \
+      } while (false)
+  #define POP() (*--sp)
+  #define PEEK(distance) (sp[-1 - (distance)])
+
+  #define READ_BYTE() (*ip++)
 
   #define READ_SHORT() \
-      (frame->ip += 2, \
-      (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+      (ip += 2, \
+      (uint16_t)((ip[-2] << 8) | ip[-1]))
 
   #define READ_CONSTANT() \
     (frame->closure->function->chunk.constants.values[READ_BYTE()])
@@ -466,458 +956,840 @@ static InterpretResult run() {
     (frame->closure->function->chunk.constants.values[READ_SHORT()])
 
   #define READ_STRING() AS_STRING(READ_CONSTANT())
+
+  #define RUNTIME_ERROR(...) \
+      do { \
+        STORE_FRAME(); \
+        runtimeError(__VA_ARGS__); \
+        return INTERPRET_RUNTIME_ERROR; \
+      } while (false)
+
   #define BINARY_OP(valueType, op) \
     do { \
-      if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-        runtimeError("SKILL ISSUE: Operands must be numbers."); \
-        return INTERPRET_RUNTIME_ERROR; \
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers."); \
       } \
-      double b = AS_NUMBER(pop()); \
-      double a = AS_NUMBER(pop()); \
-      push(valueType(a op b)); \
+      double b = AS_NUMBER(POP()); \
+      double a = AS_NUMBER(POP()); \
+      PUSH(valueType(a op b)); \
     } while (false)
 
-  for (;;) {
-    #ifdef DEBUG_TRACE_EXECUTION
-    printf("          ");
-    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-      printf("[ ");
-      printValue(*slot);
-      printf(" ]");
-    }
-    printf("\n");
-    disassembleInstruction(&frame->closure->function->chunk,
-        (int)(frame->ip - frame->closure->function->chunk.code));
-    #endif
-    uint8_t instruction;
-    switch (instruction = READ_BYTE()) {
-      case OP_CONSTANT: {
-        Value constant = READ_CONSTANT();
-        push(constant);
-        break;
-      }
-      case OP_CONSTANT_LONG: {
-        Value constant = READ_CONSTANT_LONG();
-        push(constant);
-        break;
+  #define COMPARE_JUMP(op, jumpWhen) \
+    do { \
+      uint16_t offset = READ_SHORT(); \
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers."); \
+      } \
+      double b = AS_NUMBER(POP()); \
+      double a = AS_NUMBER(POP()); \
+      if ((a op b) == jumpWhen) ip += offset; \
+    } while (false)
+
+  #ifdef DEBUG_TRACE_EXECUTION
+  #define TRACE_EXECUTION() \
+      do { \
+        printf("          "); \
+        for (Value* slot = vm.stack; slot < sp; slot++) { \
+          printf("[ "); \
+          printValue(*slot); \
+          printf(" ]"); \
+        } \
+        printf("\n"); \
+        disassembleInstruction(&frame->closure->function->chunk, \
+            (int)(ip - frame->closure->function->chunk.code)); \
+      } while (false)
+  #else
+  #define TRACE_EXECUTION() do { } while (false)
+  #endif
+
+  #ifdef DEBUG_PROFILE
+  // counts every dispatched opcode and periodically records the call stack;
+  // the registers spill first so the sampler sees a coherent frame
+  #define PROFILE_INSTRUCTION() \
+      do { \
+        profileOpcodeCounts[*ip]++; \
+        if (--profileSampleCountdown == 0) { \
+          STORE_FRAME(); \
+          profileTakeSample(); \
+        } \
+      } while (false)
+  #else
+  #define PROFILE_INSTRUCTION() do { } while (false)
+  #endif
+
+  #if defined(THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+  // direct-threaded dispatch: every handler ends with its own indirect jump
+  // through the label table, which branch predictors handle far better than
+  // one shared switch
+  static void* const dispatchTable[] = {
+      [OP_CONSTANT] = &&code_OP_CONSTANT,
+      [OP_CONSTANT_LONG] = &&code_OP_CONSTANT_LONG,
+      [OP_NIL] = &&code_OP_NIL,
+      [OP_TRUE] = &&code_OP_TRUE,
+      [OP_FALSE] = &&code_OP_FALSE,
+      [OP_POP] = &&code_OP_POP,
+      [OP_GET_LOCAL] = &&code_OP_GET_LOCAL,
+      [OP_SET_LOCAL] = &&code_OP_SET_LOCAL,
+      [OP_INC_LOCAL] = &&code_OP_INC_LOCAL,
+      [OP_DEC_LOCAL] = &&code_OP_DEC_LOCAL,
+      [OP_GET_GLOBAL] = &&code_OP_GET_GLOBAL,
+      [OP_DEFINE_GLOBAL] = &&code_OP_DEFINE_GLOBAL,
+      [OP_SET_GLOBAL] = &&code_OP_SET_GLOBAL,
+      [OP_INC_GLOBAL] = &&code_OP_INC_GLOBAL,
+      [OP_DEC_GLOBAL] = &&code_OP_DEC_GLOBAL,
+      [OP_GET_UPVALUE] = &&code_OP_GET_UPVALUE,
+      [OP_SET_UPVALUE] = &&code_OP_SET_UPVALUE,
+      [OP_GET_PROPERTY] = &&code_OP_GET_PROPERTY,
+      [OP_SET_PROPERTY] = &&code_OP_SET_PROPERTY,
+      [OP_GET_SUPER] = &&code_OP_GET_SUPER,
+      [OP_EQUAL] = &&code_OP_EQUAL,
+      [OP_GREATER] = &&code_OP_GREATER,
+      [OP_LESS] = &&code_OP_LESS,
+      [OP_ADD] = &&code_OP_ADD,
+      [OP_SUBTRACT] = &&code_OP_SUBTRACT,
+      [OP_MULTIPLY] = &&code_OP_MULTIPLY,
+      [OP_DIVIDE] = &&code_OP_DIVIDE,
+      [OP_MODULO] = &&code_OP_MODULO,
+      [OP_NOT] = &&code_OP_NOT,
+      [OP_NEGATE] = &&code_OP_NEGATE,
+      [OP_OUT] = &&code_OP_OUT,
+      [OP_JUMP] = &&code_OP_JUMP,
+      [OP_JUMP_IF_FALSE] = &&code_OP_JUMP_IF_FALSE,
+      [OP_JUMP_IF_TRUE] = &&code_OP_JUMP_IF_TRUE,
+      [OP_POP_JUMP_IF_FALSE] = &&code_OP_POP_JUMP_IF_FALSE,
+      [OP_POP_JUMP_IF_TRUE] = &&code_OP_POP_JUMP_IF_TRUE,
+      [OP_LESS_JUMP_FALSE] = &&code_OP_LESS_JUMP_FALSE,
+      [OP_LESS_JUMP_TRUE] = &&code_OP_LESS_JUMP_TRUE,
+      [OP_GREATER_JUMP_FALSE] = &&code_OP_GREATER_JUMP_FALSE,
+      [OP_GREATER_JUMP_TRUE] = &&code_OP_GREATER_JUMP_TRUE,
+      [OP_EQUAL_JUMP_FALSE] = &&code_OP_EQUAL_JUMP_FALSE,
+      [OP_EQUAL_JUMP_TRUE] = &&code_OP_EQUAL_JUMP_TRUE,
+      [OP_LOOP] = &&code_OP_LOOP,
+      [OP_CALL] = &&code_OP_CALL,
+      [OP_TAIL_CALL] = &&code_OP_TAIL_CALL,
+      [OP_INVOKE] = &&code_OP_INVOKE,
+      [OP_SUPER_INVOKE] = &&code_OP_SUPER_INVOKE,
+      [OP_CLOSURE] = &&code_OP_CLOSURE,
+      [OP_CLOSE_UPVALUE] = &&code_OP_CLOSE_UPVALUE,
+      [OP_RETURN] = &&code_OP_RETURN,
+      [OP_CLASS] = &&code_OP_CLASS,
+      [OP_INHERIT] = &&code_OP_INHERIT,
+      [OP_METHOD] = &&code_OP_METHOD,
+      [OP_ARRAY] = &&code_OP_ARRAY,
+      [OP_OBJECT_GET] = &&code_OP_OBJECT_GET,
+      [OP_OBJECT_SET] = &&code_OP_OBJECT_SET,
+      [OP_BITWISE_AND] = &&code_OP_BITWISE_AND,
+      [OP_BITWISE_OR] = &&code_OP_BITWISE_OR,
+      [OP_BITWISE_XOR] = &&code_OP_BITWISE_XOR,
+      [OP_BITWISE_LS] = &&code_OP_BITWISE_LS,
+      [OP_BITWISE_RS] = &&code_OP_BITWISE_RS,
+      [OP_BITWISE_NOT] = &&code_OP_BITWISE_NOT,
+      [OP_DICT] = &&code_OP_DICT,
+  };
+
+  #define INTERPRET_LOOP DISPATCH();
+  #define CASE_CODE(name) code_##name
+  #define DISPATCH() \
+      do { \
+        TRACE_EXECUTION(); \
+        PROFILE_INSTRUCTION(); \
+        goto *dispatchTable[instruction = READ_BYTE()]; \
+      } while (false)
+  #else
+  #define INTERPRET_LOOP \
+      loop: \
+        TRACE_EXECUTION(); \
+        PROFILE_INSTRUCTION(); \
+        switch (instruction = READ_BYTE())
+  #define CASE_CODE(name) case name
+  #define DISPATCH() goto loop
+  #endif
+
+  uint8_t instruction;
+  INTERPRET_LOOP
+  {
+    CASE_CODE(OP_CONSTANT): {
+      Value constant = READ_CONSTANT();
+      PUSH(constant);
+      DISPATCH();
+    }
+    CASE_CODE(OP_CONSTANT_LONG): {
+      Value constant = READ_CONSTANT_LONG();
+      PUSH(constant);
+      DISPATCH();
+    }
+    CASE_CODE(OP_NIL):      PUSH(NIL_VAL); DISPATCH();
+    CASE_CODE(OP_TRUE):     PUSH(BOOL_VAL(true)); DISPATCH();
+    CASE_CODE(OP_FALSE):    PUSH(BOOL_VAL(false)); DISPATCH();
+    CASE_CODE(OP_POP):      sp--; DISPATCH();
+    CASE_CODE(OP_GET_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      PUSH(frame->slots[slot]);
+      DISPATCH();
+    }
+    CASE_CODE(OP_SET_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      frame->slots[slot] = PEEK(0);
+      DISPATCH();
+    }
+    CASE_CODE(OP_INC_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      Value value = frame->slots[slot];
+      if (!IS_NUMBER(value)) {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers.");
       }
-      case OP_NIL:      push(NIL_VAL); break;
-      case OP_TRUE:     push(BOOL_VAL(true)); break;
-      case OP_FALSE:    push(BOOL_VAL(false)); break;
-      case OP_POP:      pop(); break;
-      case OP_GET_LOCAL: {
-        uint8_t slot = READ_BYTE();
-        push(frame->slots[slot]);
-        break;
+      value = NUMBER_VAL(AS_NUMBER(value) + 1);
+      frame->slots[slot] = value;
+      PUSH(value);
+      DISPATCH();
+    }
+    CASE_CODE(OP_DEC_LOCAL): {
+      uint8_t slot = READ_BYTE();
+      Value value = frame->slots[slot];
+      if (!IS_NUMBER(value)) {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers.");
       }
-      case OP_SET_LOCAL: {
-        uint8_t slot = READ_BYTE();
-        frame->slots[slot] = peek(0);
-        break;
+      value = NUMBER_VAL(AS_NUMBER(value) - 1);
+      frame->slots[slot] = value;
+      PUSH(value);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GET_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      Value value = vm.globalValues.values[slot];
+      if (IS_UNDEFINED(value)) {
+        ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+        RUNTIME_ERROR("SKILL ISSUE: Undefined variable '%s'.", name->chars);
       }
-      case OP_GET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        Value value;
-        if (!tableGet(&vm.globals, name, &value)) {
-          runtimeError("SKILL ISSUE: Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(value);
-        break;
+      PUSH(value);
+      DISPATCH();
+    }
+    CASE_CODE(OP_DEFINE_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      vm.globalValues.values[slot] = PEEK(0);
+      sp--;
+      DISPATCH();
+    }
+    CASE_CODE(OP_SET_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      if (IS_UNDEFINED(vm.globalValues.values[slot])) {
+        ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+        RUNTIME_ERROR("SKILL ISSUE: Undefined variable '%s'.", name->chars);
       }
-      case OP_DEFINE_GLOBAL: {
-        ObjString* name = READ_STRING();
-        tableSet(&vm.globals, name, peek(0));
-        pop();
-        break;
+      vm.globalValues.values[slot] = PEEK(0);
+      DISPATCH();
+    }
+    CASE_CODE(OP_INC_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      Value value = vm.globalValues.values[slot];
+      if (IS_UNDEFINED(value)) {
+        ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+        RUNTIME_ERROR("SKILL ISSUE: Undefined variable '%s'.", name->chars);
       }
-      case OP_SET_GLOBAL: {
-        ObjString* name = READ_STRING();
-        if (tableSet(&vm.globals, name, peek(0))) {
-          tableDelete(&vm.globals, name);
-          runtimeError("SKILL ISSUE: Undefined variable '%s'.", name->chars);
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      if (!IS_NUMBER(value)) {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers.");
       }
-      case OP_GET_UPVALUE: {
-        uint8_t slot = READ_BYTE();
-        push(*frame->closure->upvalues[slot]->location);
-        break;
+      value = NUMBER_VAL(AS_NUMBER(value) + 1);
+      vm.globalValues.values[slot] = value;
+      PUSH(value);
+      DISPATCH();
+    }
+    CASE_CODE(OP_DEC_GLOBAL): {
+      uint16_t slot = READ_SHORT();
+      Value value = vm.globalValues.values[slot];
+      if (IS_UNDEFINED(value)) {
+        ObjString* name = AS_STRING(vm.globalNames.values[slot]);
+        RUNTIME_ERROR("SKILL ISSUE: Undefined variable '%s'.", name->chars);
       }
-      case OP_SET_UPVALUE: {
-        uint8_t slot = READ_BYTE();
-        *frame->closure->upvalues[slot]->location = peek(0);
-        break;
+      if (!IS_NUMBER(value)) {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers.");
       }
-      case OP_GET_PROPERTY: {
-        if (IS_INSTANCE(peek(0))) {
-          ObjInstance* instance = AS_INSTANCE(peek(0));
-          ObjString* name = READ_STRING();
+      value = NUMBER_VAL(AS_NUMBER(value) - 1);
+      vm.globalValues.values[slot] = value;
+      PUSH(value);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GET_UPVALUE): {
+      uint8_t slot = READ_BYTE();
+      PUSH(*frame->closure->upvalues[slot]->location);
+      DISPATCH();
+    }
+    CASE_CODE(OP_SET_UPVALUE): {
+      uint8_t slot = READ_BYTE();
+      *frame->closure->upvalues[slot]->location = PEEK(0);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GET_PROPERTY): {
+      ObjString* name = READ_STRING();
+      uint16_t cacheSlot = READ_SHORT();
+      if (IS_INSTANCE(PEEK(0))) {
+        ObjInstance* instance = AS_INSTANCE(PEEK(0));
+        InlineCache* cache = &frame->closure->function->chunk.caches[cacheSlot];
+
+        // the shape pointer fully determines the field layout, so a matching
+        // shape means the cached slot is still the right one
+        if (cache->kind == CACHE_FIELD && cache->id == instance->shape) {
+          sp[-1] = instance->fields[cache->index]; // replace the instance
+          DISPATCH();
+        } else if (cache->kind == CACHE_METHOD &&
+                  cache->id == instance->klass &&
+                  cache->shape == instance->shape) {
+          // the shape has to match too: a same-class instance with an extra
+          // field of this name must fall through to the slow path, where the
+          // field shadows the method
+          STORE_FRAME();
+          ObjBoundMethod* bound =
+              newBoundMethod(PEEK(0), (ObjClosure*)cache->payload);
+          sp[-1] = OBJ_VAL(bound);
+          DISPATCH();
+        }
 
-          Value value;
-          if (tableGet(&instance->fields, name, &value)) {
-            pop(); // Instance.
-            push(value);
-            break;
-          }
+        int slot = shapeFieldSlot(instance->shape, name);
+        if (slot >= 0) {
+          cache->kind = CACHE_FIELD;
+          cache->id = instance->shape;
+          cache->index = (uint32_t)slot;
+          sp[-1] = instance->fields[slot]; // replace the instance
+          DISPATCH();
+        }
 
-          if (!bindMethod(instance->klass, name)) {
-            return INTERPRET_RUNTIME_ERROR;
-          }
-        } else if (IS_DICT(peek(0))) {
-          ObjDict* dict = AS_DICT(peek(0));
-          ObjString* name = READ_STRING();
-          Value value = readDict(dict, name);
-          pop(); // Dict.
-          push(value);
-        } else {
-          runtimeError("SKILL ISSUE: Only instances and dictionaries have properties.");
-          return INTERPRET_RUNTIME_ERROR;
+        Value method;
+        if (!tableGet(&instance->klass->methods, name, &method)) {
+          RUNTIME_ERROR("SKILL ISSUE: Undefined property '%s'.", name->chars);
         }
-        break;
+        cache->kind = CACHE_METHOD;
+        cache->id = instance->klass;
+        cache->shape = instance->shape;
+        cache->payload = AS_CLOSURE(method);
+        STORE_FRAME();
+        ObjBoundMethod* bound = newBoundMethod(PEEK(0), AS_CLOSURE(method));
+        sp[-1] = OBJ_VAL(bound);
+      } else if (IS_DICT(PEEK(0))) {
+        ObjDict* dict = AS_DICT(PEEK(0));
+        Value value = readDict(dict, OBJ_VAL(name));
+        sp[-1] = value; // replace the dict
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Only instances and dictionaries have properties.");
       }
-      case OP_SET_PROPERTY: {
-        if (IS_INSTANCE(peek(1))) {
-          ObjInstance* instance = AS_INSTANCE(peek(1));
-          tableSet(&instance->fields, READ_STRING(), peek(0));
-          Value value = pop();
-          pop();
-          push(value);
-        } else if (IS_DICT(peek(1))) {
-          ObjDict* dict = AS_DICT(peek(1));
-          writeDict(dict, READ_STRING(), peek(0));
-          Value value = pop();
-          pop();
-          push(value);
-        } else {
-          runtimeError("SKILL ISSUE: Only instances and dictionaries have fields.");
-          return INTERPRET_RUNTIME_ERROR;
+      DISPATCH();
+    }
+    CASE_CODE(OP_SET_PROPERTY): {
+      ObjString* name = READ_STRING();
+      uint16_t cacheSlot = READ_SHORT();
+      if (IS_INSTANCE(PEEK(1))) {
+        ObjInstance* instance = AS_INSTANCE(PEEK(1));
+        InlineCache* cache = &frame->closure->function->chunk.caches[cacheSlot];
+
+        if (cache->kind == CACHE_FIELD && cache->id == instance->shape) {
+          instance->fields[cache->index] = PEEK(0);
+          Value value = POP();
+          sp--;
+          PUSH(value);
+          DISPATCH();
         }
-        break;
+
+        STORE_FRAME();
+        instanceSetField(instance, name, PEEK(0));
+        cache->kind = CACHE_FIELD;
+        cache->id = instance->shape;
+        cache->index = (uint32_t)shapeFieldSlot(instance->shape, name);
+        Value value = POP();
+        sp--;
+        PUSH(value);
+      } else if (IS_DICT(PEEK(1))) {
+        ObjDict* dict = AS_DICT(PEEK(1));
+        STORE_FRAME();
+        writeDict(dict, OBJ_VAL(name), PEEK(0));
+        Value value = POP();
+        sp--;
+        PUSH(value);
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Only instances and dictionaries have fields.");
       }
-      case OP_GET_SUPER: {
-        ObjString* name = READ_STRING();
-        ObjClass* superclass = AS_CLASS(pop());
+      DISPATCH();
+    }
+    CASE_CODE(OP_GET_SUPER): {
+      ObjString* name = READ_STRING();
+      ObjClass* superclass = AS_CLASS(POP());
 
-        if (!bindMethod(superclass, name)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      STORE_FRAME();
+      if (!bindMethod(superclass, name)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_EQUAL: {
-        Value b = pop();
-        Value a = pop();
-        push(BOOL_VAL(valuesEqual(a, b)));
-        break;
+      sp = vm.stackTop;
+      DISPATCH();
+    }
+    CASE_CODE(OP_EQUAL): {
+      Value b = POP();
+      Value a = POP();
+      PUSH(BOOL_VAL(valuesEqual(a, b)));
+      DISPATCH();
+    }
+    CASE_CODE(OP_GREATER):  BINARY_OP(BOOL_VAL, >); DISPATCH();
+    CASE_CODE(OP_LESS):     BINARY_OP(BOOL_VAL, <); DISPATCH();
+    CASE_CODE(OP_BITWISE_AND): {
+      if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        int b = (int)AS_NUMBER(POP());
+        int a = (int)AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a & b));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: operands must be numbers.");
       }
-      case OP_GREATER:  BINARY_OP(BOOL_VAL, >); break;
-      case OP_LESS:     BINARY_OP(BOOL_VAL, <); break;
-      case OP_BITWISE_AND: {
-        if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          int b = (int)AS_NUMBER(pop());
-          int a = (int)AS_NUMBER(pop());
-          push(NUMBER_VAL(a & b));
-        } else {
-          runtimeError("SKILL ISSUE: operands must be numbers.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_BITWISE_OR): {
+      if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        int b = (int)AS_NUMBER(POP());
+        int a = (int)AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a | b));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be two numbers.");
       }
-      case OP_BITWISE_OR: {
-        if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          int b = (int)AS_NUMBER(pop());
-          int a = (int)AS_NUMBER(pop());
-          push(NUMBER_VAL(a | b));
-        } else {
-          runtimeError("SKILL ISSUE: Operands must be two numbers.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_BITWISE_XOR): {
+      if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        int b = (int)AS_NUMBER(POP());
+        int a = (int)AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a ^ b));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be two numbers.");
       }
-      case OP_BITWISE_XOR: {
-        if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          int b = (int)AS_NUMBER(pop());
-          int a = (int)AS_NUMBER(pop());
-          push(NUMBER_VAL(a ^ b));
-        } else {
-          runtimeError("SKILL ISSUE: Operands must be two numbers.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_BITWISE_LS): {
+      if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        int b = (int)AS_NUMBER(POP());
+        int a = (int)AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a << b));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be two numbers.");
       }
-      case OP_BITWISE_LS: {
-        if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          int b = (int)AS_NUMBER(pop());
-          int a = (int)AS_NUMBER(pop());
-          push(NUMBER_VAL(a << b));
-        } else {
-          runtimeError("SKILL ISSUE: Operands must be two numbers.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_BITWISE_RS): {
+      if (IS_NUMBER(PEEK(0)) & IS_NUMBER(PEEK(1))) {
+        int b = (int)AS_NUMBER(POP());
+        int a = (int)AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a >> b));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be two numbers.");
       }
-      case OP_BITWISE_RS: {
-        if (IS_NUMBER(peek(0)) & IS_NUMBER(peek(1))) {
-          int b = (int)AS_NUMBER(pop());
-          int a = (int)AS_NUMBER(pop());
-          push(NUMBER_VAL(a >> b));
-        } else {
-          runtimeError("SKILL ISSUE: Operands must be two numbers.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_BITWISE_NOT): {
+      if (IS_NUMBER(PEEK(0))) {
+        double value = AS_NUMBER(POP());
+        int intValue = (int)value;
+        int result = ~intValue;
+        PUSH(NUMBER_VAL(result));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Operand must be a number.");
       }
-      case OP_BITWISE_NOT: {
-        if (IS_NUMBER(peek(0))) {
-          double value = AS_NUMBER(pop());
-          int intValue = (int)value;
-          int result = ~intValue;
-          push(NUMBER_VAL(result));
-        } else {
-          runtimeError("SKILL ISSUE: Operand must be a number.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_ADD): {
+      if (IS_STRING(PEEK(0)) && IS_STRING(PEEK(1))) {
+        STORE_FRAME();
+        concatenate();
+        sp = vm.stackTop;
+      } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+        double b = AS_NUMBER(POP());
+        double a = AS_NUMBER(POP());
+        PUSH(NUMBER_VAL(a + b));
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be two numbers or two strings.");
       }
-      case OP_ADD: {
-        if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-          concatenate();
-        } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-          double b = AS_NUMBER(pop());
-          double a = AS_NUMBER(pop());
-          push(NUMBER_VAL(a + b));
-        } else {
-          runtimeError("SKILL ISSUE: Operands must be two numbers or two strings.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        break;
+      DISPATCH();
+    }
+    CASE_CODE(OP_MODULO): {
+      if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+        RUNTIME_ERROR("SKILL ISSUE: Operands must be numbers.");
       }
-      case OP_MODULO: {
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) {
-          runtimeError("SKILL ISSUE: Operands must be numbers.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        double b = AS_NUMBER(pop());
-        double a = AS_NUMBER(pop());
-        if (b == 0) {
-          runtimeError("SKILL ISSUE: Division by zero.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(fmod(a, b)));
-        break;
+      double b = AS_NUMBER(POP());
+      double a = AS_NUMBER(POP());
+      if (b == 0) {
+        RUNTIME_ERROR("SKILL ISSUE: Division by zero.");
       }
-      case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-      case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-      case OP_DIVIDE:   BINARY_OP(NUMBER_VAL, /); break;
-      case OP_NOT:
-        push(BOOL_VAL(isFalsey(pop())));
-        break;
-      case OP_NEGATE:
-        if (!IS_NUMBER(peek(0))) {
-          runtimeError("SKILL ISSUE: Operand must be a number.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        push(NUMBER_VAL(-AS_NUMBER(pop())));
-        break;
-      case OP_OUT: {
-        printValue(pop());
-        printf("\n");
-        break;
+      PUSH(NUMBER_VAL(fmod(a, b)));
+      DISPATCH();
+    }
+    CASE_CODE(OP_SUBTRACT): BINARY_OP(NUMBER_VAL, -); DISPATCH();
+    CASE_CODE(OP_MULTIPLY): BINARY_OP(NUMBER_VAL, *); DISPATCH();
+    CASE_CODE(OP_DIVIDE):   BINARY_OP(NUMBER_VAL, /); DISPATCH();
+    CASE_CODE(OP_NOT):
+      sp[-1] = BOOL_VAL(isFalsey(sp[-1])); // in place; POP()+PUSH() would
+                                           // modify sp twice unsequenced
+      DISPATCH();
+    CASE_CODE(OP_NEGATE):
+      if (!IS_NUMBER(PEEK(0))) {
+        RUNTIME_ERROR("SKILL ISSUE: Operand must be a number.");
       }
-      case OP_JUMP: {
-        uint16_t offset = READ_SHORT();
-        frame->ip += offset;
-        break;
+      sp[-1] = NUMBER_VAL(-AS_NUMBER(sp[-1]));
+      DISPATCH();
+    CASE_CODE(OP_OUT): {
+      outValue(POP());
+      outWrite("\n", 1);
+      DISPATCH();
+    }
+    CASE_CODE(OP_JUMP): {
+      uint16_t offset = READ_SHORT();
+      ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_JUMP_IF_FALSE): {
+      uint16_t offset = READ_SHORT();
+      if (isFalsey(PEEK(0))) ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_JUMP_IF_TRUE): {
+      uint16_t offset = READ_SHORT();
+      if (!isFalsey(PEEK(0))) ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_POP_JUMP_IF_FALSE): {
+      uint16_t offset = READ_SHORT();
+      if (isFalsey(POP())) ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_POP_JUMP_IF_TRUE): {
+      uint16_t offset = READ_SHORT();
+      if (!isFalsey(POP())) ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_LESS_JUMP_FALSE): {
+      COMPARE_JUMP(<, false);
+      DISPATCH();
+    }
+    CASE_CODE(OP_LESS_JUMP_TRUE): {
+      COMPARE_JUMP(<, true);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GREATER_JUMP_FALSE): {
+      COMPARE_JUMP(>, false);
+      DISPATCH();
+    }
+    CASE_CODE(OP_GREATER_JUMP_TRUE): {
+      COMPARE_JUMP(>, true);
+      DISPATCH();
+    }
+    CASE_CODE(OP_EQUAL_JUMP_FALSE): {
+      uint16_t offset = READ_SHORT();
+      Value b = POP();
+      Value a = POP();
+      if (!valuesEqual(a, b)) ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_EQUAL_JUMP_TRUE): {
+      uint16_t offset = READ_SHORT();
+      Value b = POP();
+      Value a = POP();
+      if (valuesEqual(a, b)) ip += offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_LOOP): {
+      uint16_t offset = READ_SHORT();
+      ip -= offset;
+      DISPATCH();
+    }
+    CASE_CODE(OP_CALL): {
+      int argCount = READ_BYTE();
+      STORE_FRAME();
+      if (!callValue(PEEK(argCount), argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_JUMP_IF_FALSE: {
-        uint16_t offset = READ_SHORT();
-        if (isFalsey(peek(0))) frame->ip += offset;
-        break;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE_CODE(OP_TAIL_CALL): {
+      int argCount = READ_BYTE();
+      Value callee = PEEK(argCount);
+      if (IS_CLOSURE(callee)) {
+        // reuse the current frame: the caller is done, so its window on the
+        // stack becomes the callee's. Recursion in tail position runs in
+        // constant frame and stack space.
+        ObjClosure* closure = AS_CLOSURE(callee);
+        if (argCount != closure->function->arity) {
+          RUNTIME_ERROR("SKILL ISSUE: Expected %d arguments but got %d.",
+                        closure->function->arity, argCount);
+        }
+        closeUpvalues(frame->slots);
+        Value* base = frame->slots;
+        for (int i = 0; i <= argCount; i++) {
+          base[i] = sp[i - argCount - 1];
+        }
+        sp = base + argCount + 1;
+        vm.stackTop = sp;
+        frame->closure = closure;
+        ip = closure->function->chunk.code;
+        DISPATCH();
       }
-      case OP_LOOP: {
-        uint16_t offset = READ_SHORT();
-        frame->ip -= offset;
-        break;
+      // natives, classes and bound methods go through the normal call path;
+      // the OP_RETURN that follows this instruction hands their result back
+      STORE_FRAME();
+      if (!callValue(callee, argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_CALL: {
-        int argCount = READ_BYTE();
-        if (!callValue(peek(argCount), argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE_CODE(OP_INVOKE): {
+      ObjString* method = READ_STRING();
+      int argCount = READ_BYTE();
+      uint16_t cacheSlot = READ_SHORT();
+      InlineCache* cache = &frame->closure->function->chunk.caches[cacheSlot];
+
+      if (IS_INSTANCE(PEEK(argCount))) {
+        ObjInstance* instance = AS_INSTANCE(PEEK(argCount));
+        ObjClosure* cached = NULL;
+        if (cache->id == instance->klass &&
+            cache->shape == instance->shape &&
+            cache->kind == CACHE_INVOKE) {
+          cached = (ObjClosure*)cache->payload;
+        } else if (cache->id2 == instance->klass &&
+                  cache->shape2 == instance->shape &&
+                  cache->kind == CACHE_INVOKE) {
+          cached = (ObjClosure*)cache->payload2;
         }
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
-      }
-      case OP_INVOKE: {
-        ObjString* method = READ_STRING();
-        int argCount = READ_BYTE();
-        if (!invoke(method, argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
+        if (cached != NULL) {
+          STORE_FRAME();
+          if (!call(cached, argCount)) {
+            return INTERPRET_RUNTIME_ERROR;
+          }
+          LOAD_FRAME();
+          DISPATCH();
         }
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
       }
-      case OP_SUPER_INVOKE: {
-        ObjString* method = READ_STRING();
-        int argCount = READ_BYTE();
-        ObjClass* superclass = AS_CLASS(pop());
-        if (!invokeFromClass(superclass, method, argCount)) {
-          return INTERPRET_RUNTIME_ERROR;
-        }
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
+
+      STORE_FRAME();
+      if (!invoke(method, argCount, cache)) {
+        return INTERPRET_RUNTIME_ERROR;
       }
-      case OP_CLOSURE: {
-        ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
-        ObjClosure* closure = newClosure(function);
-        push(OBJ_VAL(closure));
-        for (int i = 0; i < closure->upvalueCount; i++) {
-          uint8_t isLocal = READ_BYTE();
-          uint8_t index = READ_BYTE();
-          if (isLocal) {
-            closure->upvalues[i] =
-                captureUpvalue(frame->slots + index);
-          } else {
-            closure->upvalues[i] = frame->closure->upvalues[index];
-          }
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE_CODE(OP_SUPER_INVOKE): {
+      ObjString* method = READ_STRING();
+      int argCount = READ_BYTE();
+      ObjClass* superclass = AS_CLASS(POP());
+      STORE_FRAME();
+      if (!invokeFromClass(superclass, method, argCount)) {
+        return INTERPRET_RUNTIME_ERROR;
+      }
+      LOAD_FRAME();
+      DISPATCH();
+    }
+    CASE_CODE(OP_CLOSURE): {
+      ObjFunction* function = AS_FUNCTION(READ_CONSTANT());
+      if (function->upvalueCount == 0) {
+        // nothing to capture, so one closure serves every reference
+        if (function->sharedClosure == NULL) {
+          STORE_FRAME();
+          function->sharedClosure = newClosure(function);
         }
-        break;
+        PUSH(OBJ_VAL(function->sharedClosure));
+        DISPATCH();
       }
-      case OP_CLOSE_UPVALUE:
-        closeUpvalues(vm.stackTop - 1);
-        pop();
-        break;
-      case OP_RETURN: {
-        Value result = pop();
-        closeUpvalues(frame->slots);
-        vm.frameCount--;
-        if (vm.frameCount == 0) {
-          pop();
-          return INTERPRET_OK;
+      STORE_FRAME();
+      ObjClosure* closure = newClosure(function);
+      PUSH(OBJ_VAL(closure));
+      STORE_FRAME();
+      for (int i = 0; i < closure->upvalueCount; i++) {
+        uint8_t isLocal = READ_BYTE();
+        uint8_t index = READ_BYTE();
+        if (isLocal) {
+          closure->upvalues[i] =
+              captureUpvalue(frame->slots + index);
+        } else {
+          closure->upvalues[i] = frame->closure->upvalues[index];
         }
+      }
+      DISPATCH();
+    }
+    CASE_CODE(OP_CLOSE_UPVALUE):
+      closeUpvalues(sp - 1);
+      sp--;
+      DISPATCH();
+    CASE_CODE(OP_RETURN): {
+      Value result = POP();
+      closeUpvalues(frame->slots);
+      vm.frameCount--;
+      if (vm.frameCount == vm.stopFrame) {
+        sp = frame->slots;
+        vm.stackTop = sp;
+        vm.lastReturn = result;
+        return INTERPRET_OK;
+      }
 
-        // only check return type if one is specified
-        if (frame->closure->function->returnType != TYPE_NONE &&
-            !checkReturnType(frame->closure->function, result)) {
-          runtimeError("SKILL ISSUE: Invalid return type.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
+      // only check return type if one is specified
+      if (frame->closure->function->returnType != TYPE_NONE &&
+          !checkReturnType(frame->closure->function, result)) {
+        RUNTIME_ERROR("SKILL ISSUE: Invalid return type.");
+      }
 
-        vm.stackTop = frame->slots;
-        push(result);
-        frame = &vm.frames[vm.frameCount - 1];
-        break;
+      sp = frame->slots;
+      PUSH(result);
+      vm.stackTop = sp;
+      frame = &vm.frames[vm.frameCount - 1];
+      ip = frame->ip;
+      DISPATCH();
+    }
+    CASE_CODE(OP_CLASS): {
+      ObjString* name = READ_STRING();
+      STORE_FRAME();
+      PUSH(OBJ_VAL(newClass(name)));
+      DISPATCH();
+    }
+    CASE_CODE(OP_INHERIT): {
+      Value superclass = PEEK(1);
+      if (!IS_CLASS(superclass)) {
+        RUNTIME_ERROR("SKILL ISSUE: Superclass must be a class.");
       }
-      case OP_CLASS:
-        push(OBJ_VAL(newClass(READ_STRING())));
-        break;
-      case OP_INHERIT: {
-        Value superclass = peek(1);
-        if (!IS_CLASS(superclass)) {
-          runtimeError("SKILL ISSUE: Superclass must be a class.");
-          return INTERPRET_RUNTIME_ERROR;
-        }
 
-        ObjClass* subclass = AS_CLASS(peek(0));
-        tableAddAll(&AS_CLASS(superclass)->methods,
-                    &subclass->methods);
-        pop(); // subclass
-        break;
+      ObjClass* subclass = AS_CLASS(PEEK(0));
+      STORE_FRAME();
+      tableAddAll(&AS_CLASS(superclass)->methods,
+                  &subclass->methods);
+      sp--; // subclass
+      DISPATCH();
+    }
+    CASE_CODE(OP_METHOD): {
+      ObjString* name = READ_STRING();
+      STORE_FRAME();
+      defineMethod(name);
+      sp = vm.stackTop;
+      DISPATCH();
+    }
+    CASE_CODE(OP_ARRAY): {
+      int elementCount = READ_BYTE();
+      STORE_FRAME();
+      ObjArray* array = newArray();
+      push(ARRAY_VAL(array)); // keep the array reachable while it fills
+      for (int i = 0; i < elementCount; i++) {
+        writeArray(array, peek(elementCount - i));
       }
-      case OP_METHOD:
-        defineMethod(READ_STRING());
-        break;
-      case OP_ARRAY: {
-        int elementCount = READ_BYTE();
-        ObjArray* array = newArray();
-        for (int i = 0; i < elementCount; i++) {
-          writeArray(array, peek(elementCount - i - 1));
+      vm.stackTop -= elementCount + 1;
+      push(ARRAY_VAL(array));
+      sp = vm.stackTop;
+      DISPATCH();
+    }
+    CASE_CODE(OP_OBJECT_GET): {
+      if (IS_ARRAY(PEEK(1))) {
+        if (!IS_NUMBER(PEEK(0))) {
+          RUNTIME_ERROR("SKILL ISSUE: Array access requires a number.");
         }
-        for (int i = 0; i < elementCount; i++) {
-          pop();
+        int index = AS_NUMBER(POP());
+        ObjArray* array = AS_ARRAY(POP());
+        PUSH(readArray(array, index));
+      } else if (IS_DICT(PEEK(1))) {
+        Value key = POP();
+        ObjDict* dict = AS_DICT(POP());
+        PUSH(readDict(dict, key));
+      } else if (IS_FLOAT_ARRAY(PEEK(1))) {
+        if (!IS_NUMBER(PEEK(0))) {
+          RUNTIME_ERROR("SKILL ISSUE: Array access requires a number.");
         }
-        push(ARRAY_VAL(array));
-        break;
-      }
-      case OP_OBJECT_GET: {
-        if (IS_ARRAY(peek(1))) {
-          if (!IS_NUMBER(peek(0))) {
-            runtimeError("SKILL ISSUE: Array access requires a number.");
-            return INTERPRET_RUNTIME_ERROR;
-          }
-          int index = AS_NUMBER(pop());
-          ObjArray* array = AS_ARRAY(pop());
-          push(readArray(array, index));
-        } else if (IS_DICT(peek(1))) {
-          if (!IS_STRING(peek(0))) {
-            runtimeError("SKILL ISSUE: Dictionary keys must be strings.");
-            return INTERPRET_RUNTIME_ERROR;
-          }
-          ObjString* key = AS_STRING(pop());
-          ObjDict* dict = AS_DICT(pop());
-          push(readDict(dict, key));
+        int index = AS_NUMBER(POP());
+        ObjFloatArray* array = AS_FLOAT_ARRAY(POP());
+        if (index >= 0 && index < array->count) {
+          PUSH(NUMBER_VAL(array->values[index]));
         } else {
-          runtimeError("SKILL ISSUE: Only arrays and dictionaries support get set operations.");
-          return INTERPRET_RUNTIME_ERROR;
+          PUSH(NIL_VAL);
         }
-        break;
-      }
-      case OP_OBJECT_SET: {
-        if (IS_ARRAY(peek(2))) {
-          if (!IS_NUMBER(peek(1))) {
-            runtimeError("SKILL ISSUE: Array access requires a number.");
-            return INTERPRET_RUNTIME_ERROR;
-          }
-          Value value = peek(0);
-          int index = AS_NUMBER(peek(1));
-          ObjArray* array = AS_ARRAY(peek(2));
-          array->elements.values[index] = value;
-          pop();
-          pop();
-          pop();
-          push(NIL_VAL);
-        } else if (IS_DICT(peek(2))) {
-          if (!IS_STRING(peek(1))) {
-            runtimeError("SKILL ISSUE: Dictionary keys must be strings.");
-            return INTERPRET_RUNTIME_ERROR;
-          }
-          Value value = peek(0);
-          ObjString* key = AS_STRING(peek(1));
-          ObjDict* dict = AS_DICT(peek(2));
-          writeDict(dict, key, value);
-          pop();
-          pop();
-          pop();
-          push(NIL_VAL);
-        } else {
-          runtimeError("SKILL ISSUE: Only arrays and dictionaries support set operations.");
-          return INTERPRET_RUNTIME_ERROR;
+      } else if (IS_STRING(PEEK(1))) {
+        if (!IS_NUMBER(PEEK(0))) {
+          RUNTIME_ERROR("SKILL ISSUE: String access requires a number.");
         }
-        break;
+        int index = AS_NUMBER(PEEK(0));
+        ObjString* string = AS_STRING(PEEK(1));
+        Value result = NIL_VAL;
+        if (index >= 0 && index < string->length) {
+          STORE_FRAME(); // one-character strings intern, but the first sighting allocates
+          result = OBJ_VAL(copyString(string->chars + index, 1));
+        }
+        sp -= 2;
+        PUSH(result);
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Only arrays and dictionaries support get set operations.");
       }
-      case OP_DICT: {
-        ObjDict* dict = newDict();
-        int elementCount = READ_BYTE();
-        for (int i = 0; i < elementCount; i++) {
-          Value value = pop();
-          Value key = pop();
-          if (!IS_STRING(key)) {
-            runtimeError("SKILL ISSUE: Dictionary keys must be strings.");
-            return INTERPRET_RUNTIME_ERROR;
-          }
-          writeDict(dict, AS_STRING(key), value);
+      DISPATCH();
+    }
+    CASE_CODE(OP_OBJECT_SET): {
+      if (IS_ARRAY(PEEK(2))) {
+        if (!IS_NUMBER(PEEK(1))) {
+          RUNTIME_ERROR("SKILL ISSUE: Array access requires a number.");
         }
-        push(DICT_VAL(dict));
-        break;
+        Value value = PEEK(0);
+        int index = AS_NUMBER(PEEK(1));
+        ObjArray* array = AS_ARRAY(PEEK(2));
+        STORE_FRAME();
+        privatizeArray(array); // never write through a shared buffer
+        array->values[index] = value;
+        sp -= 3;
+        PUSH(NIL_VAL);
+      } else if (IS_DICT(PEEK(2))) {
+        Value value = PEEK(0);
+        Value key = PEEK(1);
+        ObjDict* dict = AS_DICT(PEEK(2));
+        STORE_FRAME();
+        writeDict(dict, key, value);
+        sp -= 3;
+        PUSH(NIL_VAL);
+      } else if (IS_FLOAT_ARRAY(PEEK(2))) {
+        if (!IS_NUMBER(PEEK(1))) {
+          RUNTIME_ERROR("SKILL ISSUE: Array access requires a number.");
+        }
+        if (!IS_NUMBER(PEEK(0))) {
+          RUNTIME_ERROR("SKILL ISSUE: Float array elements must be numbers.");
+        }
+        int index = AS_NUMBER(PEEK(1));
+        ObjFloatArray* array = AS_FLOAT_ARRAY(PEEK(2));
+        if (index < 0 || index >= array->count) {
+          RUNTIME_ERROR("SKILL ISSUE: Float array index out of bounds.");
+        }
+        array->values[index] = AS_NUMBER(PEEK(0));
+        sp -= 3;
+        PUSH(NIL_VAL);
+      } else {
+        RUNTIME_ERROR("SKILL ISSUE: Only arrays and dictionaries support set operations.");
       }
+      DISPATCH();
+    }
+    CASE_CODE(OP_DICT): {
+      int elementCount = READ_BYTE();
+      STORE_FRAME();
+      ObjDict* dict = newDict();
+      push(DICT_VAL(dict)); // keep the dict reachable while it fills
+      for (int i = 0; i < elementCount; i++) {
+        Value value = peek(2 * i + 1);
+        Value key = peek(2 * i + 2);
+        writeDict(dict, key, value);
+      }
+      vm.stackTop -= 2 * elementCount + 1;
+      push(DICT_VAL(dict));
+      sp = vm.stackTop;
+      DISPATCH();
     }
   }
+  DISPATCH(); // unknown opcode: unreachable, every OpCode has a handler
 
+  #undef STORE_FRAME
+  #undef LOAD_FRAME
+  #undef PUSH
+  #undef POP
+  #undef PEEK
   #undef READ_BYTE
   #undef READ_SHORT
   #undef READ_CONSTANT
+  #undef READ_CONSTANT_LONG
   #undef READ_STRING
+  #undef RUNTIME_ERROR
   #undef BINARY_OP
+  #undef COMPARE_JUMP
+  #undef TRACE_EXECUTION
+  #undef INTERPRET_LOOP
+  #undef CASE_CODE
+  #undef DISPATCH
 }
 
 
@@ -925,11 +1797,38 @@ InterpretResult interpret(const char* source) {
   ObjFunction* function = compile(source);
   if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
+  return interpretFunction(function);
+}
+
+InterpretResult interpretFunction(ObjFunction* function) {
   push(OBJ_VAL(function));
   ObjClosure* closure = newClosure(function);
   pop();
   push(OBJ_VAL(closure));
   call(closure, 0);
 
-  return run();
+  InterpretResult result = run();
+  vmOutFlush(); // the REPL expects output before its next prompt
+  return result;
+}
+
+// Drives one closure call to completion on the current VM and hands back its
+// return value. The parallel array natives use this from C, both on their
+// worker VMs and for the final reduce fold on the caller's VM -- the latter
+// is already inside run(), so stopFrame makes the nested run() unwind back
+// to exactly this call instead of barreling on into the enclosing frames.
+bool runClosure(ObjClosure* closure, int argCount, Value* args,
+                Value* result) {
+  push(OBJ_VAL(closure));
+  for (int i = 0; i < argCount; i++) push(args[i]);
+  if (!call(closure, argCount)) return false;
+
+  int enclosingStop = vm.stopFrame;
+  vm.stopFrame = vm.frameCount - 1;
+  InterpretResult status = run();
+  vm.stopFrame = enclosingStop;
+
+  if (status != INTERPRET_OK) return false;
+  *result = vm.lastReturn;
+  return true;
 }
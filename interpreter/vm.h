@@ -1,12 +1,14 @@
 #ifndef embr_vm_h
 #define embr_vm_h
 
+#include "embr_native.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
 #define INITIAL_FRAMES_MAX 64
 #define INITIAL_STACK_MAX (INITIAL_FRAMES_MAX * UINT8_COUNT)
+#define OUT_BUFFER_SIZE (64 * 1024)
 
 typedef struct {
   ObjClosure* closure;
@@ -18,17 +20,39 @@ typedef struct {
   CallFrame* frames;
   int framesCapacity;
   int frameCount;
+  // run() unwinds to this frame depth instead of 0 when runClosure() drives
+  // a call from C in the middle of an enclosing run(); the returned value
+  // lands in lastReturn on the way out
+  int stopFrame;
+  Value lastReturn;
 
   Value* stack;
   int stackCapacity;
   Value* stackTop;
 
-  Table globals;
+  Table globals; // name -> slot index, for the compiler and the REPL
+  ValueArray globalValues;
+  ValueArray globalNames; // slot index -> name, for error messages
   Table strings;
   ObjString* initString;
   ObjUpvalue* openUpvalues;
 
+  Shape* rootShape;
+  Shape* shapes;
+
+  size_t bytesAllocated;
+  size_t nextGC;
   Obj* objects;
+  int grayCount;
+  int grayCapacity;
+  Obj** grayStack;
+
+  // buffered 'out' stream: bytes pile up here and reach outFd in large
+  // write() batches instead of one stdio call per value. Flushed on exit,
+  // on runtime errors, and explicitly via the flush() builtin.
+  int outFd;
+  size_t outCount;
+  char outBuffer[OUT_BUFFER_SIZE];
 } VM;
 
 typedef enum {
@@ -37,12 +61,21 @@ typedef enum {
   INTERPRET_RUNTIME_ERROR
 } InterpretResult;
 
-extern VM vm;
+// one full interpreter per thread: every piece of global interpreter state
+// (this VM, the compiler and scanner, the object pages in memory.c) is
+// _Thread_local, which is what lets worker.c run isolated VMs in parallel
+// without any locking inside the interpreter
+extern _Thread_local VM vm;
 
 void initVM();
 void freeVM();
+void vmOutFlush();
 InterpretResult interpret(const char* source);
+InterpretResult interpretFunction(ObjFunction* function);
 void push(Value value);
+int globalSlot(ObjString* name);
+const EmbrHostApi* embrHostApi();
+bool runClosure(ObjClosure* closure, int argCount, Value* args, Value* result);
 static void runtimeError(const char* format, ...);
 Value pop();
 
@@ -0,0 +1,853 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "loop.h"
+#include "object.h"
+#include "table.h"
+#include "vm.h"
+#include "worker.h"
+
+// Values never cross between heaps directly: send() flattens them into this
+// malloc'd, VM-free form on the sender's thread (reading only the sender's
+// heap), and receive() rebuilds them on the receiver's thread (allocating
+// only in the receiver's heap). Neither side ever touches the other's
+// objects, so the queues need nothing beyond their own lock.
+typedef enum {
+  MSG_NIL,
+  MSG_BOOL,
+  MSG_NUMBER,
+  MSG_STRING,
+  MSG_ARRAY,
+  MSG_DICT, // items holds key,value,key,value...
+  MSG_FLOAT_ARRAY,
+} MessageType;
+
+typedef struct Message {
+  MessageType type;
+  union {
+    bool boolean;
+    double number;
+    struct {
+      char* chars;
+      int length;
+    } string;
+    struct {
+      struct Message** items;
+      int count;
+    } array;
+    struct {
+      double* values;
+      int count;
+    } floats;
+  } as;
+} Message;
+
+typedef struct MessageNode {
+  Message* message;
+  struct MessageNode* next;
+} MessageNode;
+
+typedef struct {
+  MessageNode* head;
+  MessageNode* tail;
+} MessageQueue;
+
+typedef struct {
+  pthread_t thread;
+  char* source;
+  pthread_mutex_t lock; // guards both queues and the done flag
+  pthread_cond_t ready;
+  MessageQueue inbox;
+  MessageQueue outbox;
+  bool done;
+  bool ok;
+  bool joined;
+} Worker;
+
+// the registry is deliberately process-wide (workers can spawn and message
+// workers of their own), so it is the one thing here that takes a lock
+static pthread_mutex_t registryLock = PTHREAD_MUTEX_INITIALIZER;
+static Worker** workers = NULL;
+static int workerCount = 0;
+static int workerCapacity = 0;
+
+static _Thread_local Worker* currentWorker = NULL;
+
+static void workerError(const char* message) {
+  embrHostApi()->error(message);
+}
+
+static void freeMessage(Message* message) {
+  if (message == NULL) return;
+  switch (message->type) {
+    case MSG_STRING:
+      free(message->as.string.chars);
+      break;
+    case MSG_ARRAY:
+    case MSG_DICT:
+      for (int i = 0; i < message->as.array.count; i++) {
+        freeMessage(message->as.array.items[i]);
+      }
+      free(message->as.array.items);
+      break;
+    case MSG_FLOAT_ARRAY:
+      free(message->as.floats.values);
+      break;
+    default:
+      break;
+  }
+  free(message);
+}
+
+// returns NULL for values that can't cross VMs (functions, classes,
+// instances); everything it allocates comes from malloc, not the GC heap
+static Message* encodeMessage(Value value) {
+  Message* message = (Message*)calloc(1, sizeof(Message));
+  if (message == NULL) exit(1);
+
+  if (IS_NIL(value)) {
+    message->type = MSG_NIL;
+  } else if (IS_BOOL(value)) {
+    message->type = MSG_BOOL;
+    message->as.boolean = AS_BOOL(value);
+  } else if (IS_NUMBER(value)) {
+    message->type = MSG_NUMBER;
+    message->as.number = AS_NUMBER(value);
+  } else if (IS_STRING(value)) {
+    ObjString* string = AS_STRING(value);
+    message->type = MSG_STRING;
+    message->as.string.length = string->length;
+    message->as.string.chars = (char*)malloc(string->length + 1);
+    if (message->as.string.chars == NULL) exit(1);
+    memcpy(message->as.string.chars, string->chars, string->length + 1);
+  } else if (IS_ARRAY(value)) {
+    ObjArray* array = AS_ARRAY(value);
+    message->type = MSG_ARRAY;
+    message->as.array.count = array->count;
+    message->as.array.items =
+        (Message**)calloc(array->count, sizeof(Message*));
+    for (int i = 0; i < array->count; i++) {
+      message->as.array.items[i] = encodeMessage(array->values[i]);
+      if (message->as.array.items[i] == NULL) {
+        freeMessage(message);
+        return NULL;
+      }
+    }
+  } else if (IS_DICT(value)) {
+    ValueTable* items = &AS_DICT(value)->items;
+    message->type = MSG_DICT;
+    message->as.array.items = NULL;
+    message->as.array.count = 0;
+    int capacity = 0;
+    for (int i = 0; i < items->capacity; i++) {
+      ValueEntry* entry = &items->entries[i];
+      if (IS_UNDEFINED(entry->key)) continue;
+      if (message->as.array.count + 2 > capacity) {
+        capacity = capacity < 8 ? 8 : capacity * 2;
+        message->as.array.items = (Message**)realloc(
+            message->as.array.items, sizeof(Message*) * capacity);
+        if (message->as.array.items == NULL) exit(1);
+      }
+      Message* key = encodeMessage(entry->key);
+      Message* val = key == NULL ? NULL : encodeMessage(entry->value);
+      if (val == NULL) {
+        freeMessage(key);
+        freeMessage(message);
+        return NULL;
+      }
+      message->as.array.items[message->as.array.count++] = key;
+      message->as.array.items[message->as.array.count++] = val;
+    }
+  } else if (IS_FLOAT_ARRAY(value)) {
+    ObjFloatArray* array = AS_FLOAT_ARRAY(value);
+    message->type = MSG_FLOAT_ARRAY;
+    message->as.floats.count = array->count;
+    message->as.floats.values =
+        (double*)malloc(sizeof(double) * array->count);
+    if (message->as.floats.values == NULL) exit(1);
+    memcpy(message->as.floats.values, array->values,
+           sizeof(double) * array->count);
+  } else {
+    free(message);
+    return NULL;
+  }
+  return message;
+}
+
+// rebuilds a message in the calling thread's VM. Containers are pushed while
+// they fill and children are pushed across the store, since any allocation
+// can run the collector.
+static Value decodeMessage(Message* message) {
+  switch (message->type) {
+    case MSG_NIL: return NIL_VAL;
+    case MSG_BOOL: return BOOL_VAL(message->as.boolean);
+    case MSG_NUMBER: return NUMBER_VAL(message->as.number);
+    case MSG_STRING:
+      return OBJ_VAL(
+          copyString(message->as.string.chars, message->as.string.length));
+    case MSG_ARRAY: {
+      ObjArray* array = newArray();
+      push(ARRAY_VAL(array));
+      for (int i = 0; i < message->as.array.count; i++) {
+        Value item = decodeMessage(message->as.array.items[i]);
+        push(item);
+        writeArray(array, item);
+        pop();
+      }
+      return pop();
+    }
+    case MSG_DICT: {
+      ObjDict* dict = newDict();
+      push(OBJ_VAL(dict));
+      for (int i = 0; i < message->as.array.count; i += 2) {
+        Value key = decodeMessage(message->as.array.items[i]);
+        push(key);
+        Value value = decodeMessage(message->as.array.items[i + 1]);
+        push(value);
+        writeDict(dict, key, value);
+        pop();
+        pop();
+      }
+      return pop();
+    }
+    case MSG_FLOAT_ARRAY: {
+      ObjFloatArray* array = newFloatArray(message->as.floats.count);
+      memcpy(array->values, message->as.floats.values,
+             sizeof(double) * message->as.floats.count);
+      return OBJ_VAL(array);
+    }
+  }
+  return NIL_VAL; // unreachable
+}
+
+static void queuePush(Worker* worker, MessageQueue* queue, Message* message) {
+  MessageNode* node = (MessageNode*)malloc(sizeof(MessageNode));
+  if (node == NULL) exit(1);
+  node->message = message;
+  node->next = NULL;
+
+  pthread_mutex_lock(&worker->lock);
+  if (queue->tail == NULL) {
+    queue->head = node;
+  } else {
+    queue->tail->next = node;
+  }
+  queue->tail = node;
+  pthread_cond_broadcast(&worker->ready);
+  pthread_mutex_unlock(&worker->lock);
+}
+
+// blocks until a message arrives. When stopAtDone is set (reading a worker's
+// outbox) a finished worker with an empty outbox yields NULL instead of
+// waiting forever; the inbox has no such out, since the sender may simply
+// not have gotten there yet.
+static Message* queuePop(Worker* worker, MessageQueue* queue,
+                         bool stopAtDone) {
+  pthread_mutex_lock(&worker->lock);
+  while (queue->head == NULL && !(stopAtDone && worker->done)) {
+    pthread_cond_wait(&worker->ready, &worker->lock);
+  }
+
+  MessageNode* node = queue->head;
+  Message* message = NULL;
+  if (node != NULL) {
+    queue->head = node->next;
+    if (queue->head == NULL) queue->tail = NULL;
+    message = node->message;
+    free(node);
+  }
+  pthread_mutex_unlock(&worker->lock);
+  return message;
+}
+
+static void freeQueue(MessageQueue* queue) {
+  MessageNode* node = queue->head;
+  while (node != NULL) {
+    MessageNode* next = node->next;
+    freeMessage(node->message);
+    free(node);
+    node = next;
+  }
+  queue->head = NULL;
+  queue->tail = NULL;
+}
+
+// every interpreter global is _Thread_local, so this thread gets a VM (and
+// compiler, and object pages) entirely of its own
+static void* workerMain(void* arg) {
+  Worker* worker = (Worker*)arg;
+  currentWorker = worker;
+
+  initVM();
+  InterpretResult result = interpret(worker->source);
+  if (result == INTERPRET_OK) {
+    result = runEventLoop(); // drain the worker's timers and watches too
+  }
+  freeVM();
+
+  pthread_mutex_lock(&worker->lock);
+  worker->ok = result == INTERPRET_OK;
+  worker->done = true;
+  pthread_cond_broadcast(&worker->ready);
+  pthread_mutex_unlock(&worker->lock);
+  return NULL;
+}
+
+static Worker* workerById(Value id) {
+  if (!IS_NUMBER(id)) return NULL;
+  int index = (int)AS_NUMBER(id);
+
+  pthread_mutex_lock(&registryLock);
+  Worker* worker = NULL;
+  if (index >= 0 && index < workerCount && !workers[index]->joined) {
+    worker = workers[index];
+  }
+  pthread_mutex_unlock(&registryLock);
+  return worker;
+}
+
+Value spawnNative(int argCount, Value* args) {
+  if (argCount != 1 || !IS_STRING(args[0])) {
+    workerError("SKILL ISSUE: spawn() takes the worker's source as a string.");
+    return NIL_VAL;
+  }
+
+  Worker* worker = (Worker*)calloc(1, sizeof(Worker));
+  if (worker == NULL) exit(1);
+  worker->source = (char*)malloc(AS_STRING(args[0])->length + 1);
+  if (worker->source == NULL) exit(1);
+  memcpy(worker->source, AS_CSTRING(args[0]),
+         AS_STRING(args[0])->length + 1);
+  pthread_mutex_init(&worker->lock, NULL);
+  pthread_cond_init(&worker->ready, NULL);
+
+  pthread_mutex_lock(&registryLock);
+  if (workerCount == workerCapacity) {
+    workerCapacity = workerCapacity < 8 ? 8 : workerCapacity * 2;
+    workers = (Worker**)realloc(workers, sizeof(Worker*) * workerCapacity);
+    if (workers == NULL) exit(1);
+  }
+  int id = workerCount;
+  workers[workerCount++] = worker;
+  pthread_mutex_unlock(&registryLock);
+
+  if (pthread_create(&worker->thread, NULL, workerMain, worker) != 0) {
+    workerError("SKILL ISSUE: Could not start a worker thread.");
+    return NIL_VAL;
+  }
+  return NUMBER_VAL((double)id);
+}
+
+Value sendNative(int argCount, Value* args) {
+  Worker* worker;
+  MessageQueue* queue;
+  Value value;
+
+  if (argCount == 1) {
+    worker = currentWorker;
+    if (worker == NULL) {
+      workerError("SKILL ISSUE: send(value) only works inside a worker; "
+                  "use send(id, value) from the spawning side.");
+      return NIL_VAL;
+    }
+    queue = &worker->outbox;
+    value = args[0];
+  } else if (argCount == 2) {
+    worker = workerById(args[0]);
+    if (worker == NULL) {
+      workerError("SKILL ISSUE: send() needs a live worker id.");
+      return NIL_VAL;
+    }
+    queue = &worker->inbox;
+    value = args[1];
+  } else {
+    workerError("SKILL ISSUE: send() takes a value, or a worker id and a value.");
+    return NIL_VAL;
+  }
+
+  Message* message = encodeMessage(value);
+  if (message == NULL) {
+    workerError("SKILL ISSUE: Only nil, booleans, numbers, strings, arrays "
+                "and dicts can be sent between workers.");
+    return NIL_VAL;
+  }
+  queuePush(worker, queue, message);
+  return NIL_VAL;
+}
+
+Value receiveNative(int argCount, Value* args) {
+  Worker* worker;
+  MessageQueue* queue;
+  bool stopAtDone;
+
+  if (argCount == 0) {
+    worker = currentWorker;
+    if (worker == NULL) {
+      workerError("SKILL ISSUE: receive() only works inside a worker; "
+                  "use receive(id) from the spawning side.");
+      return NIL_VAL;
+    }
+    queue = &worker->inbox;
+    stopAtDone = false;
+  } else if (argCount == 1) {
+    worker = workerById(args[0]);
+    if (worker == NULL) {
+      workerError("SKILL ISSUE: receive() needs a live worker id.");
+      return NIL_VAL;
+    }
+    queue = &worker->outbox;
+    stopAtDone = true;
+  } else {
+    workerError("SKILL ISSUE: receive() takes a worker id, or no argument inside a worker.");
+    return NIL_VAL;
+  }
+
+  Message* message = queuePop(worker, queue, stopAtDone);
+  if (message == NULL) {
+    workerError("SKILL ISSUE: Worker finished without sending anything more.");
+    return NIL_VAL;
+  }
+  Value value = decodeMessage(message);
+  freeMessage(message);
+  return value;
+}
+
+Value waitNative(int argCount, Value* args) {
+  if (argCount != 1) {
+    workerError("SKILL ISSUE: wait() takes exactly 1 argument: a worker id.");
+    return NIL_VAL;
+  }
+  Worker* worker = workerById(args[0]);
+  if (worker == NULL) {
+    workerError("SKILL ISSUE: wait() needs a live worker id.");
+    return NIL_VAL;
+  }
+
+  // claim the join before blocking so a second wait() on the same id fails
+  // cleanly instead of racing pthread_join. The id stays burned in the
+  // registry; the worker's queues and source go away with it.
+  pthread_mutex_lock(&registryLock);
+  bool claimed = !worker->joined;
+  worker->joined = true;
+  pthread_mutex_unlock(&registryLock);
+  if (!claimed) {
+    workerError("SKILL ISSUE: wait() needs a live worker id.");
+    return NIL_VAL;
+  }
+
+  pthread_join(worker->thread, NULL);
+
+  freeQueue(&worker->inbox);
+  freeQueue(&worker->outbox);
+  free(worker->source);
+  worker->source = NULL;
+  return BOOL_VAL(worker->ok);
+}
+
+// ---- parallel array natives ----
+// pmap/pfilter/preduce split an array across a pool of worker VMs, one per
+// thread, with the same isolation spawn() gets. The closure crosses over as
+// a copy of its compiled form -- code, line runs, constants, nested
+// functions -- which is why it must not capture anything: there is no
+// enclosing frame on the far side to close over.
+
+typedef struct FnBlob {
+  int arity;
+  int upvalueCount;
+  FunctionReturnType returnType;
+  char* name; // NULL when anonymous
+  int codeCount;
+  uint8_t* code;
+  int lineRunCount;
+  LineRun* lineRuns;
+  int cacheCount;
+  int constantCount;
+  Message** constants;       // one slot per constant...
+  struct FnBlob** functions; // ...except function constants, which live here
+} FnBlob;
+
+static void freeFnBlob(FnBlob* blob) {
+  if (blob == NULL) return;
+  free(blob->name);
+  free(blob->code);
+  free(blob->lineRuns);
+  for (int i = 0; i < blob->constantCount; i++) {
+    freeMessage(blob->constants[i]);
+    freeFnBlob(blob->functions[i]);
+  }
+  free(blob->constants);
+  free(blob->functions);
+  free(blob);
+}
+
+// NULL when a constant can't cross VMs (a class, say); like encodeMessage
+// this reads only the calling thread's heap
+static FnBlob* encodeFunction(ObjFunction* function) {
+  FnBlob* blob = (FnBlob*)calloc(1, sizeof(FnBlob));
+  if (blob == NULL) exit(1);
+  blob->arity = function->arity;
+  blob->upvalueCount = function->upvalueCount;
+  blob->returnType = function->returnType;
+  if (function->name != NULL) {
+    blob->name = (char*)malloc(function->name->length + 1);
+    if (blob->name == NULL) exit(1);
+    memcpy(blob->name, function->name->chars, function->name->length + 1);
+  }
+
+  Chunk* chunk = &function->chunk;
+  blob->codeCount = chunk->count;
+  blob->code = (uint8_t*)malloc(chunk->count);
+  if (blob->code == NULL) exit(1);
+  memcpy(blob->code, chunk->code, chunk->count);
+  blob->lineRunCount = chunk->lineRunCount;
+  blob->lineRuns = (LineRun*)malloc(sizeof(LineRun) * chunk->lineRunCount);
+  if (blob->lineRuns == NULL) exit(1);
+  memcpy(blob->lineRuns, chunk->lines, sizeof(LineRun) * chunk->lineRunCount);
+  blob->cacheCount = chunk->cacheCount;
+
+  blob->constantCount = chunk->constants.count;
+  blob->constants = (Message**)calloc(chunk->constants.count, sizeof(Message*));
+  blob->functions = (FnBlob**)calloc(chunk->constants.count, sizeof(FnBlob*));
+  for (int i = 0; i < chunk->constants.count; i++) {
+    Value constant = chunk->constants.values[i];
+    if (IS_FUNCTION(constant)) {
+      blob->functions[i] = encodeFunction(AS_FUNCTION(constant));
+      if (blob->functions[i] == NULL) {
+        freeFnBlob(blob);
+        return NULL;
+      }
+    } else {
+      blob->constants[i] = encodeMessage(constant);
+      if (blob->constants[i] == NULL) {
+        freeFnBlob(blob);
+        return NULL;
+      }
+    }
+  }
+  return blob;
+}
+
+// rebuilds the function in the calling thread's VM; writeChunk regrows the
+// code array and the RLE line table in one pass
+static ObjFunction* decodeFnBlob(FnBlob* blob) {
+  ObjFunction* function = newFunction();
+  push(OBJ_VAL(function));
+  function->arity = blob->arity;
+  function->upvalueCount = blob->upvalueCount;
+  function->returnType = blob->returnType;
+  if (blob->name != NULL) {
+    function->name = copyString(blob->name, (int)strlen(blob->name));
+  }
+
+  Chunk* chunk = &function->chunk;
+  // the run totals should match the byte count now that rewindChunk keeps
+  // the line table in step; the clamp is just defensive
+  int offset = 0;
+  for (int run = 0; run < blob->lineRunCount && offset < blob->codeCount;
+       run++) {
+    for (int i = 0;
+         i < blob->lineRuns[run].count && offset < blob->codeCount; i++) {
+      writeChunk(chunk, blob->code[offset++], blob->lineRuns[run].line);
+    }
+  }
+  for (int i = 0; i < blob->cacheCount; i++) {
+    addInlineCache(chunk);
+  }
+  for (int i = 0; i < blob->constantCount; i++) {
+    Value constant = blob->functions[i] != NULL
+                         ? OBJ_VAL(decodeFnBlob(blob->functions[i]))
+                         : decodeMessage(blob->constants[i]);
+    addConstant(chunk, constant); // roots the value while appending
+  }
+
+  pop();
+  return function;
+}
+
+// a snapshot of one caller global for the workers to rebuild. Globals are
+// addressed by slot index in bytecode, so every worker recreates the
+// caller's slot layout name by name; a global that can't cross (an
+// instance, a capturing closure) keeps its slot but stays undefined there
+// and trips the usual undefined-variable error if the closure touches it.
+typedef struct {
+  char* name;
+  Message* value; // plain-data global, or NULL
+  FnBlob* fn;     // capture-free function global, or NULL
+} GlobalBlob;
+
+typedef enum {
+  PAR_MAP,
+  PAR_FILTER,
+  PAR_REDUCE,
+} ParallelMode;
+
+typedef struct {
+  pthread_t thread;
+  ParallelMode mode;
+  FnBlob* fn;          // shared between tasks, read-only
+  GlobalBlob* globals; // likewise
+  int globalCount;
+  Message** items;     // slice of the caller's encoded elements, not owned
+  int count;
+  Message* output;     // owned: an array for map/filter, one value for reduce
+  bool ok;
+} ParallelTask;
+
+static void* parallelMain(void* arg) {
+  ParallelTask* task = (ParallelTask*)arg;
+  task->ok = false;
+
+  initVM();
+
+  // recreate the caller's global slots in order. globalSlot() hands back the
+  // existing slot for the natives initVM just defined and appends the rest,
+  // so indices line up with the ones baked into the copied bytecode.
+  for (int i = 0; i < task->globalCount; i++) {
+    GlobalBlob* global = &task->globals[i];
+    ObjString* name = copyString(global->name, (int)strlen(global->name));
+    int slot = globalSlot(name);
+    if (global->fn != NULL) {
+      ObjFunction* fn = decodeFnBlob(global->fn);
+      push(OBJ_VAL(fn));
+      ObjClosure* fnClosure = newClosure(fn);
+      pop();
+      vm.globalValues.values[slot] = OBJ_VAL(fnClosure);
+    } else if (global->value != NULL) {
+      vm.globalValues.values[slot] = decodeMessage(global->value);
+    }
+  }
+
+  ObjFunction* function = decodeFnBlob(task->fn);
+  push(OBJ_VAL(function));
+  ObjClosure* closure = newClosure(function);
+  pop();
+  push(OBJ_VAL(closure)); // rooted for the whole slice
+
+  // a runtime error inside runClosure resets this VM's stack and prints its
+  // own trace, so on failure just tear the VM down and report not-ok
+  if (task->mode == PAR_REDUCE) {
+    push(decodeMessage(task->items[0]));
+    for (int i = 1; i < task->count; i++) {
+      Value args[2];
+      args[0] = vm.stackTop[-1];
+      args[1] = decodeMessage(task->items[i]);
+      Value next;
+      if (!runClosure(closure, 2, args, &next)) {
+        freeVM();
+        return NULL;
+      }
+      vm.stackTop[-1] = next; // swap the rooted accumulator
+    }
+    task->output = encodeMessage(pop());
+  } else {
+    ObjArray* results = newArray();
+    push(ARRAY_VAL(results));
+    for (int i = 0; i < task->count; i++) {
+      Value element = decodeMessage(task->items[i]);
+      Value verdict;
+      if (!runClosure(closure, 1, &element, &verdict)) {
+        freeVM();
+        return NULL;
+      }
+      Value kept;
+      if (task->mode == PAR_MAP) {
+        kept = verdict;
+      } else if (!IS_NIL(verdict) && !(IS_BOOL(verdict) && !AS_BOOL(verdict))) {
+        kept = element;
+      } else {
+        continue;
+      }
+      push(kept);
+      writeArray(results, kept);
+      pop();
+    }
+    task->output = encodeMessage(pop());
+  }
+
+  task->ok = task->output != NULL;
+  freeVM();
+  return NULL;
+}
+
+static int defaultParallelism() {
+  long processors = sysconf(_SC_NPROCESSORS_ONLN);
+  return processors > 0 ? (int)processors : 1;
+}
+
+// encodes the closure and every element up front on the caller's thread,
+// fans contiguous slices out to the pool, and decodes the merged result
+// back into the caller's heap once every thread has joined
+static Value parallelRun(ParallelMode mode, ObjArray* array,
+                         ObjClosure* closure, int workers, Value initial) {
+  int count = array->count;
+  if (count == 0) {
+    return mode == PAR_REDUCE ? initial : ARRAY_VAL(newArray());
+  }
+
+  FnBlob* blob = encodeFunction(closure->function);
+  if (blob == NULL) {
+    workerError("SKILL ISSUE: Parallel closures can only carry plain data constants.");
+    return NIL_VAL;
+  }
+
+  Message** items = (Message**)calloc(count, sizeof(Message*));
+  if (items == NULL) exit(1);
+  for (int i = 0; i < count; i++) {
+    items[i] = encodeMessage(array->values[i]);
+    if (items[i] == NULL) {
+      for (int j = 0; j < i; j++) freeMessage(items[j]);
+      free(items);
+      freeFnBlob(blob);
+      workerError("SKILL ISSUE: Only nil, booleans, numbers, strings, arrays "
+                  "and dicts can cross into parallel workers.");
+      return NIL_VAL;
+    }
+  }
+
+  // snapshot the globals so the closure can call other top-level functions
+  // and read top-level data; natives are skipped since every worker's
+  // initVM defines its own in the same slots
+  int globalCount = vm.globalNames.count;
+  GlobalBlob* globals = (GlobalBlob*)calloc(globalCount, sizeof(GlobalBlob));
+  if (globals == NULL) exit(1);
+  for (int i = 0; i < globalCount; i++) {
+    ObjString* name = AS_STRING(vm.globalNames.values[i]);
+    globals[i].name = (char*)malloc(name->length + 1);
+    if (globals[i].name == NULL) exit(1);
+    memcpy(globals[i].name, name->chars, name->length + 1);
+
+    Value value = vm.globalValues.values[i];
+    if (IS_UNDEFINED(value) || IS_NATIVE(value)) continue;
+    if (IS_CLOSURE(value) && AS_CLOSURE(value)->upvalueCount == 0) {
+      globals[i].fn = encodeFunction(AS_CLOSURE(value)->function);
+    } else {
+      globals[i].value = encodeMessage(value); // NULL leaves it undefined
+    }
+  }
+
+  if (workers > count) workers = count;
+  if (workers < 1) workers = 1;
+
+  ParallelTask* tasks =
+      (ParallelTask*)calloc((size_t)workers, sizeof(ParallelTask));
+  if (tasks == NULL) exit(1);
+  int start = 0;
+  for (int w = 0; w < workers; w++) {
+    tasks[w].mode = mode;
+    tasks[w].fn = blob;
+    tasks[w].globals = globals;
+    tasks[w].globalCount = globalCount;
+    tasks[w].items = items + start;
+    tasks[w].count = (count - start) / (workers - w); // spreads the remainder
+    start += tasks[w].count;
+    if (pthread_create(&tasks[w].thread, NULL, parallelMain, &tasks[w]) != 0) {
+      exit(1);
+    }
+  }
+
+  bool allOk = true;
+  for (int w = 0; w < workers; w++) {
+    pthread_join(tasks[w].thread, NULL);
+    allOk = allOk && tasks[w].ok;
+  }
+
+  Value result = NIL_VAL;
+  if (!allOk) {
+    workerError("SKILL ISSUE: A parallel worker failed; its error is above.");
+  } else if (mode == PAR_REDUCE) {
+    // fold the per-slice partials with the same closure on this VM; that
+    // keeps preduce exact for any associative operation
+    push(initial);
+    bool folded = true;
+    for (int w = 0; w < workers && folded; w++) {
+      Value args[2];
+      args[0] = vm.stackTop[-1];
+      args[1] = decodeMessage(tasks[w].output);
+      Value next;
+      folded = runClosure(closure, 2, args, &next);
+      if (folded) vm.stackTop[-1] = next;
+    }
+    if (folded) result = pop(); // on failure the error reset the stack
+  } else {
+    ObjArray* merged = newArray();
+    push(ARRAY_VAL(merged));
+    for (int w = 0; w < workers; w++) {
+      for (int i = 0; i < tasks[w].output->as.array.count; i++) {
+        Value value = decodeMessage(tasks[w].output->as.array.items[i]);
+        push(value);
+        writeArray(merged, value);
+        pop();
+      }
+    }
+    result = pop();
+  }
+
+  for (int w = 0; w < workers; w++) freeMessage(tasks[w].output);
+  free(tasks);
+  for (int i = 0; i < globalCount; i++) {
+    free(globals[i].name);
+    freeMessage(globals[i].value);
+    freeFnBlob(globals[i].fn);
+  }
+  free(globals);
+  for (int i = 0; i < count; i++) freeMessage(items[i]);
+  free(items);
+  freeFnBlob(blob);
+  return result;
+}
+
+static ObjClosure* parallelClosure(Value value) {
+  if (!IS_CLOSURE(value)) return NULL;
+  ObjClosure* closure = AS_CLOSURE(value);
+  if (closure->upvalueCount > 0) {
+    workerError("SKILL ISSUE: Parallel closures must not capture variables; "
+                "pass everything through the array.");
+    return NULL;
+  }
+  return closure;
+}
+
+Value pmapNative(int argCount, Value* args) {
+  if (argCount < 2 || argCount > 3 || !IS_ARRAY(args[0]) ||
+      !IS_CLOSURE(args[1]) || (argCount == 3 && !IS_NUMBER(args[2]))) {
+    workerError("SKILL ISSUE: pmap() takes an array, a function of one "
+                "element, and an optional worker count.");
+    return NIL_VAL;
+  }
+  ObjClosure* closure = parallelClosure(args[1]);
+  if (closure == NULL) return NIL_VAL;
+  int workers =
+      argCount == 3 ? (int)AS_NUMBER(args[2]) : defaultParallelism();
+  return parallelRun(PAR_MAP, AS_ARRAY(args[0]), closure, workers, NIL_VAL);
+}
+
+Value pfilterNative(int argCount, Value* args) {
+  if (argCount < 2 || argCount > 3 || !IS_ARRAY(args[0]) ||
+      !IS_CLOSURE(args[1]) || (argCount == 3 && !IS_NUMBER(args[2]))) {
+    workerError("SKILL ISSUE: pfilter() takes an array, a predicate of one "
+                "element, and an optional worker count.");
+    return NIL_VAL;
+  }
+  ObjClosure* closure = parallelClosure(args[1]);
+  if (closure == NULL) return NIL_VAL;
+  int workers =
+      argCount == 3 ? (int)AS_NUMBER(args[2]) : defaultParallelism();
+  return parallelRun(PAR_FILTER, AS_ARRAY(args[0]), closure, workers, NIL_VAL);
+}
+
+Value preduceNative(int argCount, Value* args) {
+  if (argCount < 3 || argCount > 4 || !IS_ARRAY(args[0]) ||
+      !IS_CLOSURE(args[1]) || (argCount == 4 && !IS_NUMBER(args[3]))) {
+    workerError("SKILL ISSUE: preduce() takes an array, an associative "
+                "function of two values, an initial value, and an optional "
+                "worker count.");
+    return NIL_VAL;
+  }
+  ObjClosure* closure = parallelClosure(args[1]);
+  if (closure == NULL) return NIL_VAL;
+  int workers =
+      argCount == 4 ? (int)AS_NUMBER(args[3]) : defaultParallelism();
+  return parallelRun(PAR_REDUCE, AS_ARRAY(args[0]), closure, workers, args[2]);
+}
@@ -0,0 +1,40 @@
+#ifndef embr_worker_h
+#define embr_worker_h
+
+#include "value.h"
+
+// Share-nothing parallelism: spawn(source) starts an isolated VM on its own
+// thread (all interpreter state is thread-local, so the two never touch the
+// same heap) and returns a worker id. Values cross between VMs only through
+// send/receive, which deep-copy them, so there is nothing to lock inside the
+// interpreter itself.
+//
+//   spawn(source)     start a worker running the given source, returns its id
+//   send(id, value)   copy a value into worker id's inbox
+//   send(value)       from inside a worker: copy a value into its outbox
+//   receive()         from inside a worker: block for the next inbox value
+//   receive(id)       block for the next value from worker id's outbox
+//   wait(id)          block until worker id finishes; true if it ran cleanly
+//                     (join already means joining arrays into strings)
+//
+// Copyable values: nil, booleans, numbers, strings, arrays, dicts and float
+// arrays (recursively). Functions, classes and instances stay put.
+
+Value spawnNative(int argCount, Value* args);
+Value sendNative(int argCount, Value* args);
+Value receiveNative(int argCount, Value* args);
+Value waitNative(int argCount, Value* args);
+
+// Data-parallel loops over arrays on the same pool-of-VMs footing:
+//
+//   pmap(array, f [, workers])              f(element) per element, in order
+//   pfilter(array, f [, workers])           keeps elements where f is truthy
+//   preduce(array, f, initial [, workers])  folds with associative f(a, b)
+//
+// The function is copied into each worker (so it must capture nothing) and
+// the elements cross over under the same copy rules as send().
+Value pmapNative(int argCount, Value* args);
+Value pfilterNative(int argCount, Value* args);
+Value preduceNative(int argCount, Value* args);
+
+#endif